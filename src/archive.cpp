@@ -0,0 +1,443 @@
+#include "archive.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "log.hpp"
+
+namespace dc {
+
+namespace database {
+
+namespace {
+
+  constexpr char magic[8] = { 'D', 'C', 'A', 'R', 'C', 'H', '0', '1' };
+  constexpr std::int64_t seconds_per_day = 86400;
+
+  // fsync a file or directory by path
+  void sync_path(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Failed to open " + path + " for sync: " + std::strerror(errno));
+
+    int rc = ::fsync(fd);
+    ::close(fd);
+    if (rc != 0)
+      throw std::runtime_error("Failed to sync " + path + ": " + std::strerror(errno));
+  }
+
+  void write_varint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+      out += static_cast<char>((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    out += static_cast<char>(value);
+  }
+
+  std::uint64_t zigzag(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+  }
+
+  struct dictionary {
+    std::unordered_map<std::string_view, std::uint32_t> index;
+    std::string encoded;
+    std::uint32_t count{ 0 };
+
+    std::uint32_t id(std::string_view value) {
+      auto [it, inserted] = index.emplace(value, count);
+      if (inserted) {
+        write_varint(encoded, value.size());
+        encoded += value;
+        count++;
+      }
+      return it->second;
+    }
+  };
+
+} // namespace
+
+std::string segment_path(const std::string& directory, std::int64_t day) {
+  std::time_t time = day;
+  std::tm tm{};
+  gmtime_r(&time, &tm);
+
+  char name[32];
+  std::strftime(name, sizeof(name), "%Y-%m-%d.seg", &tm);
+  return (std::filesystem::path{ directory } / name).string();
+}
+
+segment::segment(const std::string& path) {
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Failed to open segment " + path);
+
+  struct stat st{};
+  ::fstat(fd, &st);
+  size = static_cast<std::size_t>(st.st_size);
+
+  if (size < sizeof(header)) {
+    ::close(fd);
+    throw std::runtime_error("Truncated segment " + path);
+  }
+
+  auto mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapped == MAP_FAILED) {
+    ::close(fd);
+    throw std::runtime_error("Failed to map segment " + path);
+  }
+
+  data = static_cast<const std::uint8_t*>(mapped);
+  std::memcpy(&header_, data, sizeof(header));
+
+  bool valid = std::memcmp(header_.magic, magic, sizeof(magic)) == 0
+    && header_.sections[0] == sizeof(header)
+    && header_.sections[7] == size
+    && std::is_sorted(std::begin(header_.sections), std::end(header_.sections));
+
+  if (!valid) {
+    ::munmap(mapped, size);
+    ::close(fd);
+    throw std::runtime_error("Corrupt segment " + path);
+  }
+
+  ::madvise(mapped, size, MADV_SEQUENTIAL);
+
+  nicks_ = read_dictionary(nick_dict, header_.nicks);
+  channels_ = read_dictionary(channel_dict, header_.channels);
+}
+
+segment::~segment() {
+  if (data)
+    ::munmap(const_cast<std::uint8_t*>(data), size);
+  if (fd >= 0)
+    ::close(fd);
+}
+
+std::vector<std::string_view> segment::read_dictionary(section s, std::uint32_t count) const {
+  std::vector<std::string_view> values;
+  values.reserve(count);
+
+  auto p = begin(s), last = end(s);
+  for (std::uint32_t i = 0; i < count && p < last; ++i) {
+    auto length = std::min<std::size_t>(detail::read_varint(p, last), last - p);
+    values.emplace_back(reinterpret_cast<const char*>(p), length);
+    p += length;
+  }
+
+  values.resize(count);
+  return values;
+}
+
+std::vector<archived_message> segment::read() const {
+  std::vector<archived_message> result;
+  result.reserve(header_.rows);
+
+  std::string text_column(header_.text_size, '\0');
+  uLongf length = static_cast<uLongf>(header_.text_size);
+  auto rc = ::uncompress(reinterpret_cast<Bytef*>(text_column.data()), &length,
+      begin(text), static_cast<uLong>(end(text) - begin(text)));
+  if (rc != Z_OK)
+    throw std::runtime_error("Failed to decompress segment text");
+
+  auto tp = reinterpret_cast<const std::uint8_t*>(text_column.data());
+  auto tp_end = tp + length;
+
+  scan([&](std::int64_t id, std::int64_t timestamp, std::uint32_t nick, std::uint32_t channel) {
+        auto size = std::min<std::size_t>(detail::read_varint(tp, tp_end), tp_end - tp);
+        std::string message_text{ reinterpret_cast<const char*>(tp), size };
+        tp += size;
+
+        result.push_back({ id, {
+          timestamp,
+          std::string{ nick < nicks_.size() ? nicks_[nick] : std::string_view{} },
+          std::string{ channel < channels_.size() ? channels_[channel] : std::string_view{} },
+          std::move(message_text)
+        }});
+      });
+
+  return result;
+}
+
+void segment::write(const std::string& path, std::vector<archived_message> rows) {
+  std::sort(rows.begin(), rows.end(),
+      [](const auto& a, const auto& b) {
+        return std::tie(a.msg.timestamp, a.id) < std::tie(b.msg.timestamp, b.id);
+      });
+
+  rows.erase(std::unique(rows.begin(), rows.end(),
+        [](const auto& a, const auto& b) { return a.id == b.id; }), rows.end());
+
+  header h{};
+  std::memcpy(h.magic, magic, sizeof(magic));
+  h.rows = static_cast<std::uint32_t>(rows.size());
+  h.first_timestamp = rows.empty() ? 0 : rows.front().msg.timestamp;
+  h.first_id = rows.empty() ? 0 : rows.front().id;
+
+  dictionary nicks, channels;
+  std::string id_column, timestamp_column, nick_column, channel_column, text_column;
+
+  auto last_id = h.first_id;
+  auto last_timestamp = h.first_timestamp;
+
+  for (const auto& row: rows) {
+    write_varint(id_column, zigzag(row.id - last_id));
+    write_varint(timestamp_column, static_cast<std::uint64_t>(row.msg.timestamp - last_timestamp));
+    write_varint(nick_column, nicks.id(row.msg.nick));
+    write_varint(channel_column, channels.id(row.msg.channel));
+    write_varint(text_column, row.msg.text.size());
+    text_column += row.msg.text;
+
+    last_id = row.id;
+    last_timestamp = row.msg.timestamp;
+  }
+
+  h.nicks = nicks.count;
+  h.channels = channels.count;
+  h.text_size = text_column.size();
+
+  std::string compressed(::compressBound(static_cast<uLong>(text_column.size())), '\0');
+  uLongf compressed_size = static_cast<uLongf>(compressed.size());
+  if (::compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+        reinterpret_cast<const Bytef*>(text_column.data()),
+        static_cast<uLong>(text_column.size()), Z_BEST_COMPRESSION) != Z_OK)
+    throw std::runtime_error("Failed to compress segment text");
+  compressed.resize(compressed_size);
+
+  const std::string* sections[] = {
+    &nicks.encoded, &channels.encoded, &id_column, &timestamp_column,
+    &nick_column, &channel_column, &compressed
+  };
+
+  std::uint64_t offset = sizeof(header);
+  for (std::size_t i = 0; i < std::size(sections); ++i) {
+    h.sections[i] = offset;
+    offset += sections[i]->size();
+  }
+  h.sections[7] = offset;
+
+  // Written next to the target and renamed over it, so readers only ever
+  // map a complete segment. Both the data and the rename reach the disk
+  // before this returns; the caller deletes the rows right after.
+  auto temporary = path + ".tmp";
+  {
+    std::ofstream out{ temporary, std::ios::binary | std::ios::trunc };
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    for (auto section: sections)
+      out.write(section->data(), static_cast<std::streamsize>(section->size()));
+
+    if (!out.flush())
+      throw std::runtime_error("Failed to write segment " + temporary);
+  }
+
+  sync_path(temporary);
+  std::filesystem::rename(temporary, path);
+
+  auto directory = std::filesystem::path{ path }.parent_path();
+  sync_path(directory.empty() ? "." : directory.string());
+}
+
+archiver::archiver(const std::string& path, const settings& settings)
+  : settings_(settings)
+{
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+    std::stringstream msg;
+    msg << "Failed to open archive connection: " << sqlite3_errmsg(db);
+    sqlite3_close(db);
+    throw std::runtime_error(msg.str());
+  }
+
+  sqlite3_busy_timeout(db, 5000);
+
+  std::filesystem::create_directories(settings_.archive_dir);
+
+  worker = std::thread{ [this] { run(); } };
+}
+
+archiver::~archiver() {
+  stop();
+}
+
+void archiver::stop() {
+  {
+    std::lock_guard lock{ mutex };
+    stopping = true;
+  }
+
+  wake.notify_one();
+
+  if (worker.joinable())
+    worker.join();
+
+  if (db) {
+    sqlite3_close(db);
+    db = nullptr;
+  }
+}
+
+archiver::stats archiver::get_stats() const {
+  return { days.load(), rows.load(), bytes.load() };
+}
+
+void archiver::run() {
+  std::unique_lock lock{ mutex };
+
+  while (!stopping) {
+    lock.unlock();
+    archive_old();
+    lock.lock();
+
+    wake.wait_for(lock, std::chrono::seconds(settings_.archive_interval),
+        [this] { return stopping; });
+  }
+}
+
+void archiver::archive_old() {
+  auto now = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  // Only whole days are archived, so a segment is normally written once;
+  // archive_day merges late rows into one that already exists
+  auto cutoff = now - settings_.archive_after * seconds_per_day;
+  cutoff -= cutoff % seconds_per_day;
+
+  sqlite3_stmt* oldest{ nullptr };
+  if (sqlite3_prepare_v2(db, "SELECT MIN(timestamp) FROM message WHERE timestamp < ?;", -1, &oldest, nullptr) != SQLITE_OK) {
+    log::error(log::subsystem::archive, sqlite3_errmsg(db));
+    return;
+  }
+
+  sqlite3_bind_int64(oldest, 1, cutoff);
+
+  for (;;) {
+    {
+      std::lock_guard lock{ mutex };
+      if (stopping)
+        break;
+    }
+
+    if (sqlite3_step(oldest) != SQLITE_ROW || sqlite3_column_type(oldest, 0) == SQLITE_NULL)
+      break;
+
+    auto timestamp = sqlite3_column_int64(oldest, 0);
+    sqlite3_reset(oldest);
+
+    if (!archive_day(timestamp - timestamp % seconds_per_day))
+      break;
+  }
+
+  sqlite3_finalize(oldest);
+}
+
+bool archiver::archive_day(std::int64_t day) {
+  static constexpr auto select_sql =
+    "SELECT id, timestamp, nick, channel, message FROM message "
+    "WHERE timestamp >= ? AND timestamp < ?;";
+
+  sqlite3_stmt* select{ nullptr };
+  if (sqlite3_prepare_v2(db, select_sql, -1, &select, nullptr) != SQLITE_OK) {
+    log::error(log::subsystem::archive, sqlite3_errmsg(db));
+    return false;
+  }
+
+  sqlite3_bind_int64(select, 1, day);
+  sqlite3_bind_int64(select, 2, day + seconds_per_day);
+
+  auto text = [select](int column) {
+    auto data = reinterpret_cast<const char*>(sqlite3_column_text(select, column));
+    return std::string{ data ? data : "", static_cast<std::size_t>(sqlite3_column_bytes(select, column)) };
+  };
+
+  std::vector<archived_message> day_rows;
+  std::int64_t max_id{ 0 };
+
+  while (sqlite3_step(select) == SQLITE_ROW) {
+    auto id = sqlite3_column_int64(select, 0);
+    max_id = std::max<std::int64_t>(max_id, id);
+    day_rows.push_back({ id, { sqlite3_column_int64(select, 1), text(2), text(3), text(4) } });
+  }
+
+  sqlite3_finalize(select);
+
+  auto moved = day_rows.size();
+  auto path = segment_path(settings_.archive_dir, day);
+  std::optional<std::uintmax_t> previous_size;
+
+  try {
+    // A crash between writing a segment and deleting its rows leaves both;
+    // merging on id drops the duplicates
+    if (std::filesystem::exists(path)) {
+      previous_size = std::filesystem::file_size(path);
+      auto existing = segment{ path }.read();
+      day_rows.insert(day_rows.end(),
+          std::make_move_iterator(existing.begin()), std::make_move_iterator(existing.end()));
+    }
+
+    segment::write(path, std::move(day_rows));
+  } catch (const std::exception& e) {
+    log::error(log::subsystem::archive, e.what());
+    return false;
+  }
+
+  sqlite3_stmt* remove{ nullptr };
+  auto remove_sql = "DELETE FROM message WHERE timestamp >= ? AND timestamp < ? AND id <= ?;";
+  if (sqlite3_prepare_v2(db, remove_sql, -1, &remove, nullptr) != SQLITE_OK) {
+    log::error(log::subsystem::archive, sqlite3_errmsg(db));
+    return false;
+  }
+
+  sqlite3_bind_int64(remove, 1, day);
+  sqlite3_bind_int64(remove, 2, day + seconds_per_day);
+  sqlite3_bind_int64(remove, 3, max_id);
+
+  bool ok = exec("BEGIN IMMEDIATE;");
+  if (ok && sqlite3_step(remove) != SQLITE_DONE) {
+    log::error(log::subsystem::archive, "Delete failed: ", sqlite3_errmsg(db));
+    ok = false;
+  }
+  sqlite3_finalize(remove);
+
+  if (!ok || !exec("COMMIT;")) {
+    exec("ROLLBACK;");
+    return false;
+  }
+
+  // A merged segment replaces its old size rather than adding to it
+  auto size = std::filesystem::file_size(path);
+  auto before = previous_size.value_or(0);
+  if (!previous_size)
+    days++;
+  rows += moved;
+  if (size >= before)
+    bytes += size - before;
+  else
+    bytes -= before - size;
+
+  log::info(log::subsystem::archive, path, ": ", moved, " rows");
+  return true;
+}
+
+bool archiver::exec(const char* sql) {
+  char* error{ nullptr };
+  if (sqlite3_exec(db, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+    log::error(log::subsystem::archive, sql, " failed: ", error);
+    sqlite3_free(error);
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace database
+
+} // namespace dc
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "message_log.hpp"
+
+namespace dc {
+
+namespace database {
+
+struct archived_message {
+  std::int64_t id;
+  message msg;
+};
+
+namespace detail {
+
+  inline std::uint64_t read_varint(const std::uint8_t*& p, const std::uint8_t* end) {
+    std::uint64_t value{ 0 };
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+      auto byte = *p++;
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    return value;
+  }
+
+  inline std::int64_t unzigzag(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+  }
+
+} // namespace detail
+
+/*
+ * One day of archived messages, stored column by column and read through
+ * mmap. Nick and channel are dictionary encoded, ids and timestamps are
+ * delta encoded varints, and the text column is zlib compressed so scans
+ * that only look at who/where/when never touch it.
+ *
+ * Integers in the header are in host byte order.
+ */
+class segment {
+public:
+  struct header {
+    char magic[8];
+    std::uint32_t rows;
+    std::uint32_t nicks;
+    std::uint32_t channels;
+    std::uint32_t reserved;
+    std::int64_t first_timestamp;
+    std::int64_t first_id;
+    std::uint64_t text_size;
+    // nick dict, channel dict, ids, timestamps, nick ids, channel ids,
+    // text, end of file
+    std::uint64_t sections[8];
+  };
+
+  enum section { nick_dict, channel_dict, ids, timestamps, nick_ids, channel_ids, text };
+
+private:
+  int fd{ -1 };
+  const std::uint8_t* data{ nullptr };
+  std::size_t size{ 0 };
+  header header_{};
+  std::vector<std::string_view> nicks_;
+  std::vector<std::string_view> channels_;
+
+  const std::uint8_t* begin(section s) const { return data + header_.sections[s]; }
+  const std::uint8_t* end(section s) const { return data + header_.sections[s + 1]; }
+
+  std::vector<std::string_view> read_dictionary(section s, std::uint32_t count) const;
+
+public:
+  explicit segment(const std::string& path);
+  ~segment();
+
+  segment(const segment&) = delete;
+  segment& operator=(const segment&) = delete;
+
+  std::size_t rows() const { return header_.rows; }
+  const std::vector<std::string_view>& nicks() const { return nicks_; }
+  const std::vector<std::string_view>& channels() const { return channels_; }
+
+  // The UTC day this segment holds
+  std::int64_t day() const { return header_.first_timestamp - header_.first_timestamp % 86400; }
+
+  // Calls f(id, timestamp, nick index, channel index) for every row, in
+  // timestamp order, without decompressing any text
+  template <class F>
+    void scan(F&& f) const {
+      auto ip = begin(ids), ip_end = end(ids);
+      auto ts = begin(timestamps), ts_end = end(timestamps);
+      auto ni = begin(nick_ids), ni_end = end(nick_ids);
+      auto ci = begin(channel_ids), ci_end = end(channel_ids);
+
+      auto id = header_.first_id;
+      auto timestamp = header_.first_timestamp;
+      for (std::uint32_t row = 0; row < header_.rows; ++row) {
+        id += detail::unzigzag(detail::read_varint(ip, ip_end));
+        timestamp += static_cast<std::int64_t>(detail::read_varint(ts, ts_end));
+        auto nick = static_cast<std::uint32_t>(detail::read_varint(ni, ni_end));
+        auto channel = static_cast<std::uint32_t>(detail::read_varint(ci, ci_end));
+        f(id, timestamp, nick, channel);
+      }
+    }
+
+  std::vector<archived_message> read() const;
+
+  static void write(const std::string& path, std::vector<archived_message> rows);
+};
+
+/*
+ * Moves whole days older than archive_after days out of the `message`
+ * table into one segment file per day, on its own connection and thread.
+ */
+class archiver {
+public:
+  struct stats {
+    std::uint64_t days;
+    std::uint64_t rows;
+    std::uint64_t bytes;
+  };
+
+private:
+  sqlite3* db{ nullptr };
+  settings settings_;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping{ false };
+
+  std::atomic<std::uint64_t> days{ 0 };
+  std::atomic<std::uint64_t> rows{ 0 };
+  std::atomic<std::uint64_t> bytes{ 0 };
+
+  std::thread worker;
+
+public:
+  archiver(const std::string& path, const settings& settings);
+  ~archiver();
+
+  archiver(const archiver&) = delete;
+  archiver& operator=(const archiver&) = delete;
+
+  void stop();
+
+  stats get_stats() const;
+
+private:
+  void run();
+  void archive_old();
+  bool archive_day(std::int64_t day);
+  bool exec(const char* sql);
+};
+
+std::string segment_path(const std::string& directory, std::int64_t day);
+
+} // namespace database
+
+} // namespace dc
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.hpp"
+#include "log.hpp"
+
+namespace dc {
+
+/*
+ * Glue between the callback based APIs and asio completion tokens. The
+ * `async_*` functions built on it take a plain callback or, inside a
+ * coroutine, `asio::use_awaitable`:
+ *
+ *   auto result = co_await search.async_count(a, asio::use_awaitable);
+ *
+ * Awaitable frames come from asio's per-thread recycling allocator, so a
+ * suspended command costs no heap allocation per hop once warmed up.
+ */
+
+// Wraps a (possibly move-only) completion handler in a copyable callable
+// that runs it once on the handler's own executor, or on `fallback`
+template <class... Args, class Handler, class Executor>
+  std::function<void(Args...)> make_completion(Handler handler, const Executor& fallback) {
+    auto shared = std::make_shared<Handler>(std::move(handler));
+    auto executor = asio::get_associated_executor(*shared, fallback);
+
+    return [shared, executor](Args... args) {
+      asio::post(executor,
+          [shared, ...args = std::move(args)]() mutable {
+            std::move(*shared)(std::move(args)...);
+          });
+    };
+  }
+
+// Completion for co_spawn that logs whatever escaped the coroutine
+inline auto log_exception(log::subsystem source) {
+  return [source](std::exception_ptr e) {
+    if (!e)
+      return;
+
+    try {
+      std::rethrow_exception(e);
+    } catch (const std::exception& ex) {
+      log::error(source, "Task failed: ", ex.what());
+    }
+  };
+}
+
+} // namespace dc
@@ -0,0 +1,223 @@
+#include "commands.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#include "async.hpp"
+
+namespace dc {
+
+namespace commands {
+
+constexpr auto settings_fields = std::make_tuple(
+    optional("prefix", &settings::prefix));
+
+std::error_code decode(const json::value& jv, settings& s) {
+  return decode_object(jv, s, settings_fields);
+}
+
+namespace {
+
+  // Owns copies of everything the context points at, for the task's lifetime
+  asio::awaitable<void> run_task(task run, std::string channel, std::string nick,
+      std::string command, std::string args, responder respond) {
+    context ctx{ channel, nick, command, args, &respond };
+    co_await run(ctx);
+  }
+
+  char lower(char c) {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+
+  std::uint64_t fnv1a_64(std::uint64_t hash, std::string_view data) {
+    for (auto c: data) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 0x100000001b3;
+    }
+    return hash;
+  }
+
+  std::uint64_t cooldown_key(std::uint32_t command, char scope,
+      std::string_view channel, std::string_view nick = {}) {
+    auto hash = fnv1a_64(0xcbf29ce484222325, { &scope, 1 });
+    hash = fnv1a_64(hash, { reinterpret_cast<const char*>(&command), sizeof(command) });
+    hash = fnv1a_64(hash, channel);
+    hash = fnv1a_64(hash, { "\0", 1 });
+    return fnv1a_64(hash, nick);
+  }
+
+} // namespace
+
+bool cooldowns::try_acquire(std::initializer_list<request> requests, clock::time_point now) {
+  std::lock_guard lock{ mutex };
+
+  for (const auto& r: requests) {
+    if (r.duration <= clock::duration::zero())
+      continue;
+
+    auto it = expiry.find(r.key);
+    if (it != expiry.end() && it->second > now)
+      return false;
+  }
+
+  for (const auto& r: requests) {
+    if (r.duration <= clock::duration::zero())
+      continue;
+
+    // A run out entry whose timer has not fired yet keeps that timer
+    auto [it, inserted] = expiry.insert_or_assign(r.key, now + r.duration);
+    if (inserted)
+      timers.schedule(r.duration, [this, key = r.key] { expire(key); });
+  }
+
+  return true;
+}
+
+void cooldowns::expire(std::uint64_t key) {
+  std::lock_guard lock{ mutex };
+
+  auto it = expiry.find(key);
+  if (it == expiry.end())
+    return;
+
+  auto now = clock::now();
+  if (it->second <= now) {
+    expiry.erase(it);
+    return;
+  }
+
+  // Re-acquired after running out, before this timer got to it
+  timers.schedule(it->second - now, [this, key] { expire(key); });
+}
+
+std::size_t cooldowns::size() {
+  std::lock_guard lock{ mutex };
+  return expiry.size();
+}
+
+router::router(const settings& settings, asio::io_context& io, timer_service& timers)
+  : settings_(settings)
+  , io(io)
+  , trie(1)
+  , cooldowns_(timers)
+  , dispatched(metrics::global().get_counter("dc_commands_total", "Chat commands run"))
+  , cooling_down(metrics::global().get_counter("dc_commands_cooldown_total", "Chat commands ignored while cooling down"))
+  , dispatch_time(metrics::global().get_histogram("dc_commands_dispatch_nanoseconds", "Time to match and run a chat command"))
+{}
+
+std::uint32_t router::insert(std::string_view name) {
+  std::uint32_t index{ 0 };
+
+  for (auto c: name) {
+    c = lower(c);
+    auto& children = trie[index].children;
+    auto it = std::lower_bound(children.begin(), children.end(), c,
+        [](const auto& child, char c) { return child.first < c; });
+
+    if (it != children.end() && it->first == c) {
+      index = it->second;
+      continue;
+    }
+
+    auto next = static_cast<std::uint32_t>(trie.size());
+    children.insert(it, { c, next });
+    trie.emplace_back();
+    index = next;
+  }
+
+  return index;
+}
+
+std::optional<std::uint32_t> router::find(std::string_view name) const {
+  std::uint32_t index{ 0 };
+
+  for (auto c: name) {
+    c = lower(c);
+    const auto& children = trie[index].children;
+    auto it = std::lower_bound(children.begin(), children.end(), c,
+        [](const auto& child, char c) { return child.first < c; });
+
+    if (it == children.end() || it->first != c)
+      return std::nullopt;
+
+    index = it->second;
+  }
+
+  return trie[index].command;
+}
+
+void router::add(std::string_view name, handler run, options opts) {
+  auto id = static_cast<std::uint32_t>(commands_.size());
+  commands_.push_back({ std::string{ name }, std::move(run), opts });
+  trie[insert(name)].command = id;
+}
+
+void router::add_task(std::string_view name, task run, options opts) {
+  add(name,
+      [this, run = std::move(run)](const context& ctx) {
+        asio::co_spawn(io, run_task(run, std::string{ ctx.channel }, std::string{ ctx.nick },
+              std::string{ ctx.command }, std::string{ ctx.args }, *ctx.respond),
+            log_exception(log::subsystem::core));
+      },
+      opts);
+}
+
+bool router::alias(std::string_view alias, std::string_view name) {
+  auto id = find(name);
+  if (!id)
+    return false;
+
+  trie[insert(alias)].command = id;
+  return true;
+}
+
+bool router::dispatch(std::string_view channel, std::string_view nick, std::string_view text,
+    const responder& respond) {
+  if (text.size() <= settings_.prefix.size() || text.substr(0, settings_.prefix.size()) != settings_.prefix)
+    return false;
+
+  auto start = std::chrono::steady_clock::now();
+
+  text.remove_prefix(settings_.prefix.size());
+  auto space = text.find(' ');
+  auto name = text.substr(0, space);
+
+  std::string_view args;
+  if (space != std::string_view::npos) {
+    args = text.substr(space + 1);
+    args.remove_prefix(std::min(args.find_first_not_of(' '), args.size()));
+  }
+
+  auto id = find(name);
+  if (!id)
+    return false;
+
+  const auto& cmd = commands_[*id];
+
+  auto acquired = cooldowns_.try_acquire({
+      { cooldown_key(*id, 'u', channel, nick), cmd.opts.user_cooldown },
+      { cooldown_key(*id, 'c', channel), cmd.opts.channel_cooldown },
+    }, start);
+
+  if (!acquired) {
+    cooling_down.add();
+    return false;
+  }
+
+  cmd.run({ channel, nick, cmd.name, args, &respond });
+
+  dispatched.add();
+  dispatch_time.record(std::chrono::steady_clock::now() - start);
+  return true;
+}
+
+std::vector<std::string_view> router::names() const {
+  std::vector<std::string_view> out;
+  for (const auto& cmd: commands_)
+    out.push_back(cmd.name);
+  return out;
+}
+
+} // namespace commands
+
+} // namespace dc
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <mutex>
+
+#include "common.hpp"
+#include "metrics.hpp"
+#include "timer_wheel.hpp"
+
+namespace dc {
+
+namespace commands {
+
+struct settings {
+  std::string prefix{ "!" };
+};
+
+std::error_code decode(const json::value& jv, settings& s);
+
+// Sends text back to a channel on whichever platform the command came from
+using responder = std::function<void(std::string_view channel, std::string_view text)>;
+
+struct context {
+  std::string_view channel;
+  std::string_view nick;
+  std::string_view command;
+  std::string_view args;
+  const responder* respond;
+
+  void reply(std::string_view text) const { (*respond)(channel, text); }
+};
+
+using handler = std::function<void(const context&)>;
+
+// A command that co_awaits; its context stays valid until it finishes
+using task = std::function<asio::awaitable<void>(const context&)>;
+
+struct options {
+  std::chrono::milliseconds user_cooldown{ 0 };
+  std::chrono::milliseconds channel_cooldown{ 0 };
+};
+
+/*
+ * Running cooldowns by key. A key is cooling down while its entry is
+ * live; each entry holds one timer on the timing wheel that forgets it
+ * once it has run out.
+ */
+class cooldowns {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct request {
+    std::uint64_t key;
+    clock::duration duration;
+  };
+
+private:
+  timer_service& timers;
+  std::mutex mutex;
+  std::unordered_map<std::uint64_t, clock::time_point> expiry;
+
+public:
+  explicit cooldowns(timer_service& timers)
+    : timers(timers)
+  {}
+
+  // Starts every cooldown in `requests` unless one of them is still running
+  bool try_acquire(std::initializer_list<request> requests, clock::time_point now);
+
+  std::size_t size();
+
+private:
+  void expire(std::uint64_t key);
+};
+
+/*
+ * Chat command dispatch. Command names and aliases live in a trie keyed by
+ * lowercased characters, so a lookup costs one step per character however
+ * many commands are registered. Commands must be added before messages
+ * start arriving; dispatch itself is safe from any thread.
+ */
+class router {
+  struct node {
+    std::vector<std::pair<char, std::uint32_t>> children;
+    std::optional<std::uint32_t> command;
+  };
+
+  struct command {
+    std::string name;
+    handler run;
+    options opts;
+  };
+
+  settings settings_;
+  asio::io_context& io;
+  std::vector<node> trie;
+  std::vector<command> commands_;
+  cooldowns cooldowns_;
+
+  metrics::counter& dispatched;
+  metrics::counter& cooling_down;
+  metrics::histogram& dispatch_time;
+
+public:
+  router(const settings& settings, asio::io_context& io, timer_service& timers);
+
+  router(const router&) = delete;
+  router& operator=(const router&) = delete;
+
+  void add(std::string_view name, handler run, options opts = {});
+  // Spawned on the io context, so dispatch returns at the first co_await
+  void add_task(std::string_view name, task run, options opts = {});
+  // False if `name` is not a registered command
+  bool alias(std::string_view alias, std::string_view name);
+
+  // True if `text` invoked a command that was not cooling down
+  bool dispatch(std::string_view channel, std::string_view nick, std::string_view text,
+      const responder& respond);
+
+  std::vector<std::string_view> names() const;
+
+private:
+  std::uint32_t insert(std::string_view name);
+  std::optional<std::uint32_t> find(std::string_view name) const;
+};
+
+} // namespace commands
+
+} // namespace dc
@@ -5,21 +5,23 @@
 #include <deque>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <optional>
-#include <regex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <tuple>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include <asio.hpp>
 #include <asio/ssl.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/json.hpp>
-#include <boost/lexical_cast.hpp>
 
 namespace dc {
 
@@ -27,24 +29,223 @@ namespace dc {
   namespace json  = boost::json;
 
   using tcp = asio::ip::tcp;
+  using io_strand = asio::strand<asio::io_context::executor_type>;
+
+  // Transparent hash, so string keyed maps can be searched by string_view
+  // without building a std::string first
+  struct string_hash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view s) const noexcept {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
 
   template <class T>
-    void extract(const json::object& object, T& t, json::string_view key) {
-      t = json::value_to<T>(object.at(key));
+    using string_map = std::unordered_map<std::string, T, string_hash, std::equal_to<>>;
+
+  /*
+   * Struct decoding from a table of field descriptors:
+   *
+   *   constexpr auto fields = std::make_tuple(
+   *       required("id", &User::id),
+   *       optional("bot", &User::bot));
+   *
+   *   std::error_code decode(const json::value& jv, User& u) {
+   *     return decode_object(jv, u, fields);
+   *   }
+   *
+   * The object's members are walked once and matched against the table.
+   * Optional fields keep whatever the struct was initialized with, and
+   * unknown keys are ignored. Types decode through a `decode` overload
+   * found by ADL, so a struct with its own overload can be a field too.
+   */
+  enum class decode_error {
+    not_an_object = 1,
+    missing_field,
+    wrong_type,
+    out_of_range,
+  };
+
+  class decode_category_impl : public std::error_category {
+  public:
+    const char* name() const noexcept override { return "decode"; }
+
+    std::string message(int ev) const override {
+      switch (static_cast<decode_error>(ev)) {
+        case decode_error::not_an_object: return "expected an object";
+        case decode_error::missing_field: return "missing required field";
+        case decode_error::wrong_type:    return "field has the wrong type";
+        case decode_error::out_of_range:  return "number out of range";
+      }
+      return "unknown decode error";
+    }
+  };
+
+  inline const std::error_category& decode_category() {
+    static decode_category_impl category;
+    return category;
+  }
+
+  inline std::error_code make_error_code(decode_error e) {
+    return { static_cast<int>(e), decode_category() };
+  }
+
+  template <class T, class M>
+    struct field {
+      std::string_view key;
+      M T::* member;
+      bool required;
+    };
+
+  template <class T, class M>
+    constexpr field<T, M> required(std::string_view key, M T::* member) {
+      return { key, member, true };
+    }
+
+  template <class T, class M>
+    constexpr field<T, M> optional(std::string_view key, M T::* member) {
+      return { key, member, false };
     }
 
+  inline std::error_code decode(const json::value& jv, bool& out) {
+    auto b = jv.if_bool();
+    if (!b)
+      return make_error_code(decode_error::wrong_type);
+
+    out = *b;
+    return {};
+  }
+
+  inline std::error_code decode(const json::value& jv, std::string& out) {
+    auto s = jv.if_string();
+    if (!s)
+      return make_error_code(decode_error::wrong_type);
+
+    out.assign(s->data(), s->size());
+    return {};
+  }
+
   template <class T>
-    void extract_maybe(const json::object& object, T& t, json::string_view key, T default_ = T()) {
-      if (object.count(key))
-        t = json::value_to<T>(object.at(key));
-      else
-        t = default_;
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, std::error_code>
+    decode(const json::value& jv, T& out) {
+      if (auto i = jv.if_int64()) {
+        if constexpr (std::is_unsigned_v<T>) {
+          if (*i < 0 || static_cast<std::uint64_t>(*i) > std::numeric_limits<T>::max())
+            return make_error_code(decode_error::out_of_range);
+        } else {
+          if (*i < std::numeric_limits<T>::min() || *i > std::numeric_limits<T>::max())
+            return make_error_code(decode_error::out_of_range);
+        }
+        out = static_cast<T>(*i);
+        return {};
+      }
+
+      if (auto u = jv.if_uint64()) {
+        if (*u > static_cast<std::make_unsigned_t<T>>(std::numeric_limits<T>::max()))
+          return make_error_code(decode_error::out_of_range);
+        out = static_cast<T>(*u);
+        return {};
+      }
+
+      return make_error_code(decode_error::wrong_type);
     }
 
+  template <class Rep, class Period>
+    std::error_code decode(const json::value& jv, std::chrono::duration<Rep, Period>& out);
+
+  template <class T>
+    std::error_code decode(const json::value& jv, std::vector<T>& out);
+
   template <class T>
-    void extract_optional(const json::object& object, std::optional<T>& t, json::string_view key) {
-      if (!object.at(key).is_null())
-        t = std::make_optional<T>(json::value_to<T>(object.at(key)));
+    std::error_code decode(const json::value& jv, std::optional<T>& out);
+
+  // A bare number is taken in the duration's own unit
+  template <class Rep, class Period>
+    std::error_code decode(const json::value& jv, std::chrono::duration<Rep, Period>& out) {
+      Rep count{};
+      if (auto ec = decode(jv, count))
+        return ec;
+
+      out = std::chrono::duration<Rep, Period>(count);
+      return {};
+    }
+
+  template <class T>
+    std::error_code decode(const json::value& jv, std::vector<T>& out) {
+      auto array = jv.if_array();
+      if (!array)
+        return make_error_code(decode_error::wrong_type);
+
+      out.clear();
+      out.reserve(array->size());
+      for (const auto& element: *array) {
+        if (auto ec = decode(element, out.emplace_back()))
+          return ec;
+      }
+      return {};
+    }
+
+  template <class T>
+    std::error_code decode(const json::value& jv, std::optional<T>& out) {
+      if (jv.is_null()) {
+        out.reset();
+        return {};
+      }
+
+      return decode(jv, out.emplace());
+    }
+
+  template <class T, class... Fields>
+    std::error_code decode_object(const json::value& jv, T& out, const std::tuple<Fields...>& fields) {
+      static_assert(sizeof...(Fields) <= 64, "too many fields for the seen mask");
+
+      auto object = jv.if_object();
+      if (!object)
+        return make_error_code(decode_error::not_an_object);
+
+      std::uint64_t seen{ 0 };
+      std::error_code ec;
+
+      for (const auto& member: *object) {
+        std::string_view key{ member.key().data(), member.key().size() };
+        std::size_t index{ 0 };
+        bool matched{ false };
+
+        auto visit = [&](const auto& field) {
+          if (!matched && key == field.key) {
+            matched = true;
+            seen |= std::uint64_t{ 1 } << index;
+            ec = decode(member.value(), out.*(field.member));
+          }
+          ++index;
+        };
+
+        std::apply([&](const auto&... field) { (visit(field), ...); }, fields);
+
+        if (ec)
+          return ec;
+      }
+
+      std::size_t index{ 0 };
+      bool missing{ false };
+
+      auto check = [&](const auto& field) {
+        auto bit = std::uint64_t{ 1 } << index++;
+        if (field.required && !(seen & bit))
+          missing = true;
+      };
+
+      std::apply([&](const auto&... field) { (check(field), ...); }, fields);
+
+      return missing ? make_error_code(decode_error::missing_field) : std::error_code{};
     }
 
 } // namespace dc
+
+namespace std {
+
+  template <>
+    struct is_error_code_enum<dc::decode_error> : true_type {};
+
+} // namespace std
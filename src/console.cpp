@@ -1,59 +1,167 @@
 #include "console.hpp"
 
+#include <algorithm>
+
+#include "async.hpp"
+#include "log.hpp"
+
 namespace dc {
 
 namespace console {
 
-settings tag_invoke(json::value_to_tag<settings>, const json::value& jv) {
-  settings s;
-  const json::object& obj = jv.as_object();
-  extract(obj, s.enabled, "enabled");
-  extract(obj, s.port, "port");
-  return s;
+constexpr auto settings_fields = std::make_tuple(
+    required("enabled", &settings::enabled),
+    required("port", &settings::port));
+
+std::error_code decode(const json::value& jv, settings& s) {
+  return decode_object(jv, s, settings_fields);
 }
 
 using asio::ip::tcp;
 
+bool glob_match(std::string_view pattern, std::string_view text) {
+  std::size_t p = 0, t = 0;
+  std::size_t star = std::string_view::npos, resume = 0;
+
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      ++p;
+      ++t;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = t;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      t = ++resume;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*')
+    ++p;
+
+  return p == pattern.size();
+}
+
 connection::connection(tcp::socket socket, server* server)
   : socket_(std::move(socket))
   , server_(server)
+  , queued_lines_(metrics::global().get_gauge("dc_console_write_queue_lines", "Console lines waiting to be written"))
 {}
 
-void connection::send(std::string data) {
-  bool write_in_progress = !write_queue.empty();
-  write_queue.push_back(std::move(data));
+connection::~connection() {
+  queued_lines_.add(-static_cast<std::int64_t>(queued_reported_));
+}
 
-  if (!write_in_progress)
-    do_write();
+void connection::report_queue() {
+  auto size = write_queue_.size();
+  queued_lines_.add(static_cast<std::int64_t>(size) - static_cast<std::int64_t>(queued_reported_));
+  queued_reported_ = size;
 }
 
-void connection::send_line(std::string data) {
-  data += "\n";
-  send(std::move(data));
+void connection::send(std::string_view data) {
+  asio::dispatch(socket_.get_executor(),
+      [self = shared_from_this(), data = std::string{ data }] {
+        self->queue_write(data, {});
+      });
+}
+
+void connection::send_line(std::string_view data) {
+  asio::dispatch(socket_.get_executor(),
+      [self = shared_from_this(), data = std::string{ data }] {
+        self->queue_write(data, "\n");
+      });
+}
+
+void connection::queue_write(std::string_view data, std::string_view terminator) {
+  write_queue_.push(data, terminator);
+  report_queue();
+
+  if (!write_queue_.writing())
+    do_write();
 }
 
 void connection::do_write() {
   auto self(shared_from_this());
-  asio::async_write(socket_,
-      asio::buffer(write_queue.front().data(), write_queue.front().size()),
+  asio::async_write(socket_, write_queue_.prepare(),
       [this, self](const auto& error, std::size_t /* length */) {
         if (!error) {
-          write_queue.pop_front();
-          if (!write_queue.empty()) {
+          write_queue_.consume();
+          report_queue();
+          if (!write_queue_.empty()) {
             do_write();
+          } else {
+            flush_tail();
           }
         } else {
-          std::cerr << "[Console] Write error: " << error.message() << '\n';
+          log::error(log::subsystem::console, "Write error: ", error.message());
         }
       }
   );
+}
 
+void connection::set_tail(std::optional<std::string> pattern) {
+  std::lock_guard lock{ tail_mutex_ };
+  tail_pattern_ = std::move(pattern);
+  tail_lines_.clear();
+  tail_dropped_ = 0;
+}
+
+void connection::offer_tail(std::string_view channel, std::string_view line) {
+  {
+    std::lock_guard lock{ tail_mutex_ };
+    if (!tail_pattern_ || !glob_match(*tail_pattern_, channel))
+      return;
+
+    if (tail_lines_.size() >= max_tail_lines) {
+      tail_lines_.pop_front();
+      tail_dropped_++;
+    }
+
+    tail_lines_.emplace_back(line);
+
+    if (tail_scheduled_)
+      return;
+    tail_scheduled_ = true;
+  }
+
+  asio::post(socket_.get_executor(),
+      [self = shared_from_this()] {
+        self->flush_tail();
+      });
+}
+
+void connection::flush_tail() {
+  std::deque<std::string> lines;
+  std::uint64_t dropped;
+  {
+    std::lock_guard lock{ tail_mutex_ };
+    tail_scheduled_ = false;
+
+    // Still writing: the write completion calls back here
+    if (write_queue_.writing() || tail_lines_.empty())
+      return;
+
+    lines.swap(tail_lines_);
+    dropped = tail_dropped_;
+    tail_dropped_ = 0;
+  }
+
+  if (dropped)
+    write_queue_.push("-- dropped " + std::to_string(dropped) + " lines", "\n");
+
+  for (const auto& line: lines)
+    write_queue_.push(line, "\n");
+  report_queue();
+
+  do_write();
 }
 
 void connection::on_command(const std::string& command) {
-  std::cout << "[Console] Command: " << command << '\n';
+  log::info(log::subsystem::console, "Command: ", command);
 
-  server_->handle_command(command);
+  server_->handle_command(shared_from_this(), command);
 
   send(": ");
 }
@@ -63,7 +171,8 @@ void connection::await_command() {
 
   auto handler = [this, self](const auto& error, std::size_t s) {
     if (error) {
-      std::cerr << "[Console] Disconnected\n";
+      log::info(log::subsystem::console, "Disconnected");
+      set_tail(std::nullopt);
       return;
     }
 
@@ -80,7 +189,7 @@ void connection::await_command() {
 }
 
 void connection::start() {
-  std::cout << "[Console] Connection from " << socket_.remote_endpoint() << " accepted\n";
+  log::info(log::subsystem::console, "Connection from ", socket_.remote_endpoint(), " accepted");
 
   send_line("HENLO");
   send(": ");
@@ -93,15 +202,30 @@ server::server(asio::io_context& ctx, const settings& settings)
   , settings_(settings)
   , acceptor(ctx, tcp::endpoint(tcp::v4(), settings_.port))
 {
+  register_handler("tail",
+      [this](connection::pointer client, std::string_view args) {
+        tail(client, args);
+      });
+
   if (settings_.enabled)
     start_accept();
 }
 
 void server::register_handler(std::string name, command_handler handler) {
+  std::unique_lock lock{ handlers_mutex };
   command_handlers_[std::move(name)].push_back(handler);
 }
 
-void server::handle_command(const std::string& command) {
+void server::register_task(std::string name, command_task task) {
+  register_handler(std::move(name),
+      [task = std::move(task)](connection::pointer client, std::string_view args) {
+        auto executor = client->executor();
+        asio::co_spawn(executor, task(std::move(client), std::string{ args }),
+            log_exception(log::subsystem::console));
+      });
+}
+
+void server::handle_command(connection::pointer client, const std::string& command) {
   std::string cmd;
   std::string attr;
 
@@ -113,30 +237,76 @@ void server::handle_command(const std::string& command) {
     attr = command.substr(first_space + 1);
   }
 
-  for (auto& handler: command_handlers_[cmd]) {
-    handler(attr);
+  std::vector<command_handler> handlers;
+  {
+    std::shared_lock lock{ handlers_mutex };
+    auto it = command_handlers_.find(cmd);
+    if (it != command_handlers_.end())
+      handlers = it->second;
   }
+
+  for (auto& handler: handlers) {
+    handler(client, attr);
+  }
+}
+
+void server::publish(std::string_view channel, std::string_view line) {
+  bool expired{ false };
+  {
+    std::shared_lock lock{ tails_mutex };
+    for (const auto& weak: tails) {
+      if (auto client = weak.lock())
+        client->offer_tail(channel, line);
+      else
+        expired = true;
+    }
+  }
+
+  if (expired) {
+    std::unique_lock lock{ tails_mutex };
+    tails.erase(std::remove_if(tails.begin(), tails.end(),
+          [](const auto& weak) { return weak.expired(); }), tails.end());
+  }
+}
+
+void server::tail(connection::pointer client, std::string_view pattern) {
+  if (pattern == "off") {
+    client->set_tail(std::nullopt);
+    client->send_line("tail off");
+    return;
+  }
+
+  std::string glob{ pattern.empty() ? "*" : pattern };
+  client->set_tail(glob);
+  client->send_line("tailing " + glob + ", `tail off` to stop");
+
+  std::unique_lock lock{ tails_mutex };
+  auto known = std::any_of(tails.begin(), tails.end(),
+      [&](const auto& weak) { return weak.lock() == client; });
+  if (!known)
+    tails.push_back(client);
 }
 
 void server::start_accept() {
-  acceptor.async_accept(
+  acceptor.async_accept(io_strand(ctx.get_executor()),
       [this](const auto& error, tcp::socket socket) {
         if (!error) {
-          std::make_shared<connection>(std::move(socket), this)->start();
+          auto client = std::make_shared<connection>(std::move(socket), this);
+          asio::dispatch(client->executor(), [client] { client->start(); });
         }
 
         start_accept();
       }
   );
 
-  std::cout << "[Console] Accepting connections on port " << settings_.port << '\n';
+  log::info(log::subsystem::console, "Accepting connections on port ", settings_.port);
 }
 
 void server::handle_accept(connection::pointer connection, const std::error_code& error) {
   if (!error) {
     connection->start();
   } else {
-    std::cerr << "[Console] Accept error: " << error.message() << '\n';
+    log::error(log::subsystem::console, "Accept error: ", error.message());
   }
 
   start_accept();
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <mutex>
+#include <shared_mutex>
+
 #include "common.hpp"
+#include "metrics.hpp"
+#include "write_queue.hpp"
 
 namespace dc {
 
@@ -11,23 +16,42 @@ struct settings {
   int port;
 };
 
-settings tag_invoke(json::value_to_tag<settings>, const json::value& jv);
+std::error_code decode(const json::value& jv, settings& s);
 
 using asio::ip::tcp;
 
 class server;
 
+bool glob_match(std::string_view pattern, std::string_view text);
+
 class connection : public std::enable_shared_from_this<connection> {
+public:
+  static constexpr std::size_t max_tail_lines = 256;
+
+private:
   tcp::socket socket_;
   asio::streambuf buffer_;
-  std::deque<std::string> write_queue;
+  write_queue write_queue_;
   server* server_;
 
-  void send(std::string data);
-  void send_line(std::string data);
+  // Shared by every connection; this one's share is in queued_reported_
+  metrics::gauge& queued_lines_;
+  std::size_t queued_reported_{ 0 };
+
+  // Tailed lines wait here until the socket has drained; when a slow client
+  // falls max_tail_lines behind the oldest are dropped
+  std::mutex tail_mutex_;
+  std::optional<std::string> tail_pattern_;
+  std::deque<std::string> tail_lines_;
+  std::uint64_t tail_dropped_{ 0 };
+  bool tail_scheduled_{ false };
+
   void on_command(const std::string& command);
 
+  void queue_write(std::string_view data, std::string_view terminator);
   void do_write();
+  void flush_tail();
+  void report_queue();
 
   void await_command();
 
@@ -35,25 +59,47 @@ public:
   using pointer = std::shared_ptr<connection>;
 
   connection(tcp::socket socket, server* server);
+  ~connection();
 
   void start();
+  auto executor() { return socket_.get_executor(); }
+
+  void send(std::string_view data);
+  void send_line(std::string_view data);
+
+  void set_tail(std::optional<std::string> pattern);
+  void offer_tail(std::string_view channel, std::string_view line);
 };
 
 class server {
-  using command_handler = std::function<void(std::string_view)>;
+public:
+  // Handlers may reply on the connection from any thread
+  using command_handler = std::function<void(connection::pointer, std::string_view)>;
+  // Runs as a coroutine on the connection's strand
+  using command_task = std::function<asio::awaitable<void>(connection::pointer, std::string)>;
+
+private:
 
   asio::io_context& ctx;
   settings settings_;
   tcp::acceptor acceptor;
+  std::shared_mutex handlers_mutex;
   std::unordered_map<std::string, std::vector<command_handler>> command_handlers_;
+  std::shared_mutex tails_mutex;
+  std::vector<std::weak_ptr<connection>> tails;
 
 public:
   server(asio::io_context& ctx, const settings& settings);
 
   void register_handler(std::string name, command_handler handler);
-  void handle_command(const std::string& command);
+  void register_task(std::string name, command_task task);
+  void handle_command(connection::pointer client, const std::string& command);
+
+  // Fans a line out to every connection tailing a matching channel
+  void publish(std::string_view channel, std::string_view line);
 
 private:
+  void tail(connection::pointer client, std::string_view pattern);
   void start_accept();
 
   void handle_accept(connection::pointer connection, const std::error_code& error);
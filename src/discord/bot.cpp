@@ -1,259 +1,178 @@
 #include "bot.hpp"
 
-#include "event.hpp"
+#include <algorithm>
+
+#include "../log.hpp"
 
 namespace dc {
 
 namespace discord {
 
-Settings tag_invoke(json::value_to_tag<Settings>, const json::value& jv) {
-  Settings s;
-  const auto& object = jv.as_object();
-  extract(object, s.enabled, "enabled");
-  extract(object, s.token, "token");
-  return s;
-}
-
 void Bot::run() {
-  using boost::placeholders::_1;
-
   if (!settings.enabled)
     return;
 
-  session = std::make_shared<Session>(io, ctx);
-
-  if (!gateway)
-    updateGateway();
-  else
-    session->run(*gateway, boost::bind(&Bot::onSessionData, this, _1));
+  updateGateway();
 }
 
 void Bot::reconnect() {
-  heartbeat->cancel();
-  session->disconnect(boost::bind(&Bot::onDisconnect, this));
+  for (auto& shard: shards)
+    shard->reconnect();
 }
 
 void Bot::createChannelMessage(size_t channel, const std::string& message) {
-  auto request = std::make_shared<Request>(asio::make_strand(io), ctx, "discord.com", settings.token);
-
-  std::string endpoint{ "/api/v8/channels/" };
-  endpoint += std::to_string(channel);
-  endpoint += "/messages";
-
-  json::object payload{
-    { "content", message }
-  };
-
-  request->post(endpoint, json::serialize(payload),
-      [this](const beast::error_code& ec, const json::value& response) {
+  asyncCreateChannelMessage(channel, message,
+      [](const beast::error_code& ec, const json::value& response) {
         if (ec) {
-          std::cerr << "[Discord] Failed to create message\n";
+          log::error(log::subsystem::discord, "Failed to create message");
         }
 
-        std::cout << "[Discord] Message create response: " << response << '\n';
+        log::debug(log::subsystem::discord, "Message create response: ", response);
       });
 }
 
-void Bot::onSessionData(const json::value& payload) {
-  OpCode op = json::value_to<OpCode>(payload.at("op"));
-  auto data  = payload.at("d");
-
-  switch (op) {
-    case OpCode::Dispatch: {
-      sequence   = json::value_to<int>(payload.at("s"));
-      auto event = json::value_to<std::string>(payload.at("t"));
-
-      onDispatch(event, data);
-    } break;
-    case OpCode::Heartbeat: {
-    } break;
-    case OpCode::Reconnect: {
-      std::cout << "[Discord] Reconnect\n";
-      onReconnect();
-    } break;
-    case OpCode::InvalidSession: {
-      std::cout << "[Discord] Invalid Session received: " << payload << '\n';
-      onInvalidSession();
-    } break;
-    case OpCode::Hello: {
-      onHello(json::value_to<int>(data.at("heartbeat_interval")));
-    } break;
-    case OpCode::HeartbeatAck: {
-      needAck--;
-      if (needAck < 0) {
-        std::cerr << "[Discord] Received extra Heartbeat Ack\n";
-      }
-    } break;
-    default: {
-      std::cout << "[Discord] Unexpected opcode: " << static_cast<int>(op)
-        << ", payload: " << payload << '\n';
-    } break;
-  }
-}
-
-void Bot::onDispatch(const std::string& event, const json::value& data) {
-  auto hash = fnv1a_32(event);
-
-  switch (static_cast<Event>(hash)) {
-    case Event::Ready: {
-      onReady(data);
-    } break;
-    case Event::Resumed: {
-      std::cout << "[Discord] Resume payload: " << data << '\n';
-    } break;
-    default: {
-      std::cout << "[Discord] Unhandled dispatch event `" << event << "`, payload: " << data << '\n';
-    } break;
-  }
-}
-
-void Bot::onReconnect() {
-  reconnect();
-}
-
-void Bot::onInvalidSession() {
-  session_id.clear();
-  identified = false;
-
-  reconnect();
-}
-
-void Bot::onDisconnect() {
-  using boost::placeholders::_1;
-
-  std::cout << "[Discord] onDisconnect\n";
-
-  session = std::make_shared<Session>(io, ctx);
-  session->run(*gateway, boost::bind(&Bot::onSessionData, this, _1));
-}
-
-void Bot::onHello(int heartbeatInterval) {
-  std::cout << "[Discord] Hello\n";
-
-  heartrate = std::chrono::milliseconds(heartbeatInterval);
-
-  sendHeartbeat(boost::system::errc::make_error_code(
-        boost::system::errc::success));
+void Bot::registerCacheHandlers() {
+  auto on = [this](Event event, void (Cache::*apply)(const json::value&)) {
+    registerHandler(event, [this, apply](const json::value& data) { (cache.*apply)(data); });
+  };
 
-  if (!identified) {
-    sendIdentify();
-  } else {
-    sendResume();
-  }
+  on(Event::GuildCreate, &Cache::onGuildCreate);
+  on(Event::GuildUpdate, &Cache::onGuildUpdate);
+  on(Event::GuildDelete, &Cache::onGuildDelete);
+  on(Event::ChannelCreate, &Cache::onChannelUpdate);
+  on(Event::ChannelUpdate, &Cache::onChannelUpdate);
+  on(Event::ChannelDelete, &Cache::onChannelDelete);
+  on(Event::GuildMemberAdd, &Cache::onMemberUpdate);
+  on(Event::GuildMemberUpdate, &Cache::onMemberUpdate);
+  on(Event::GuildMemberRemove, &Cache::onMemberRemove);
+  on(Event::GuildMembersChunk, &Cache::onMembersChunk);
+}
+
+void Bot::requestIdentify(Shard& shard) {
+  asio::post(strand,
+      [this, &shard] {
+        identifyQueues[shard.getId() % maxConcurrency].push_back(&shard);
+        pumpIdentify();
+      });
 }
 
-void Bot::onReady(const json::value& data) {
-  identified = true;
-  session_id = json::value_to<std::string>(data.at("session_id"));
+void Bot::pumpIdentify() {
+  auto now = std::chrono::steady_clock::now();
+  std::optional<std::chrono::steady_clock::time_point> wake;
 
-  me = std::make_optional<User>(json::value_to<User>(data.at("user")));
+  for (std::size_t bucket = 0; bucket < identifyQueues.size(); ++bucket) {
+    auto& queue = identifyQueues[bucket];
+    if (queue.empty())
+      continue;
 
-  std::cout << "[Discord] Identified as " << me->username << '\n';
-}
+    if (nextIdentify[bucket] <= now) {
+      queue.front()->identify();
+      queue.pop_front();
+      nextIdentify[bucket] = now + identifyInterval;
+    }
 
-void Bot::sendHeartbeat(const boost::system::error_code& ec) {
-  if (ec) {
-    std::cerr << "[Discord] Error sending heartbeat: " << ec.message() << '\n';
+    if (!queue.empty() && (!wake || nextIdentify[bucket] < *wake))
+      wake = nextIdentify[bucket];
   }
 
-  if (needAck > 0) {
-    std::cout << "[Discord] Unacked heartbeat, reconnecting\n";
-    reconnect();
+  if (!wake || identifyArmed)
     return;
-  }
 
-  heartbeat = std::make_unique<boost::asio::steady_timer>(
-      io, std::chrono::steady_clock::now() + heartrate);
-  heartbeat->async_wait(
+  identifyArmed = true;
+  identifyTimer.expires_at(*wake);
+  identifyTimer.async_wait(
       [this](const boost::system::error_code& ec) {
-        sendHeartbeat(ec);
+        identifyArmed = false;
+        if (!ec)
+          pumpIdentify();
       });
+}
 
-  std::cout << "[Discord] Heartbeat [sequence: " << sequence << "]\n";
-
-  needAck++;
+void Bot::registerHandler(Event event, event_handler handler) {
+  std::unique_lock lock{ handlersMutex };
+  handlers[static_cast<std::uint32_t>(event)].push_back(std::move(handler));
+}
 
-  if (sequence >= 0) {
-    send(OpCode::Heartbeat, sequence);
-  } else {
-    send(OpCode::Heartbeat, nullptr);
-  }
+bool Bot::wants(std::string_view event) {
+  std::shared_lock lock{ handlersMutex };
+  return handlers.count(fnv1a_32(event)) > 0;
 }
 
-void Bot::sendIdentify() {
-  const int intents = GUILD_MESSAGES | DIRECT_MESSAGES;
-
-  json::object data{
-    { "token", settings.token },
-    { "intents", intents },
-    { "properties", {
-      { "$os", "linux" },
-      { "$browser", "DigitalColleague" },
-      { "$device", "DigitalColleague" }
-    }},
-    { "compress", false },
-    { "presence", {
-      { "activities", nullptr },
-      { "status", "online" },
-      { "since", nullptr },
-      { "afk", false }
-    }}
-  };
+void Bot::onDispatch(Shard& shard, std::string_view event, const json::value& data) {
+  auto hash = fnv1a_32(event);
 
-  std::cout << "[Discord] Identifying\n";
+  if (static_cast<Event>(hash) == Event::Ready)
+    onReady(shard, data);
 
-  send(OpCode::Identify, data);
-}
+  std::vector<event_handler> matching;
+  {
+    std::shared_lock lock{ handlersMutex };
+    auto it = handlers.find(hash);
+    if (it != handlers.end())
+      matching = it->second;
+  }
 
-void Bot::sendResume() {
-  json::object data{
-    { "token", settings.token },
-    { "session_id", session_id },
-    { "seq", sequence }
-  };
+  for (auto& handler: matching)
+    handler(data);
+}
 
-  std::cout << "[Discord] Resuming\n";
+void Bot::onReady(Shard& shard, const json::value& data) {
+  std::lock_guard lock{ meMutex };
 
-  send(OpCode::Resume, data);
-}
+  User user;
+  if (auto ec = decode(data.at("user"), user)) {
+    log::error(log::subsystem::discord, "[Shard ", shard.getId(), "] Bad READY user: ", ec.message());
+    return;
+  }
 
-void Bot::send(OpCode op, const json::value& data) {
-  json::object payload{
-    { "op", static_cast<int>(op) },
-    { "d", data }
-  };
+  me = std::move(user);
 
-  session->send(payload);
+  log::info(log::subsystem::discord, "[Shard ", shard.getId(), "] Identified as ", me->username);
 }
 
 void Bot::updateGateway() {
-  using boost::placeholders::_1;
-  using boost::placeholders::_2;
-
-  auto request = std::make_shared<Request>(asio::make_strand(io), ctx, "discord.com", settings.token);
-
-  request->get("/api/v8/gateway/bot",
-      boost::bind(&Bot::onGatewayUpdated, this, _1, _2));
+  rest->get("/api/v8/gateway/bot",
+      [this](const beast::error_code& ec, const json::value& data) {
+        asio::post(strand, [this, ec, data] { onGatewayUpdated(ec, data); });
+      });
 }
 
 void Bot::onGatewayUpdated(const beast::error_code& ec, const json::value& data) {
-  using boost::placeholders::_1;
-
   if (ec) {
-    std::cerr << "[Discord] Failed to get gateway: " << ec.message() << '\n';
+    log::error(log::subsystem::discord, "Failed to get gateway: ", ec.message());
     return;
   }
 
-  gateway = json::value_to<Gateway>(data);
+  Gateway decoded;
+  if (auto error = decode(data, decoded)) {
+    log::error(log::subsystem::discord, "Bad gateway response: ", error.message());
+    return;
+  }
+
+  gateway = std::move(decoded);
+
+  log::info(log::subsystem::discord, "Gateway: ", gateway->url, ", shard: ", gateway->shards);
+  log::info(log::subsystem::discord, "SessionStartLimit ["
+      "total: ", gateway->sessionStartLimit.total,
+      ", remaining: ", gateway->sessionStartLimit.remaining,
+      ", resetAfter: ", gateway->sessionStartLimit.resetAfter,
+      ", maxConcurrency: ", gateway->sessionStartLimit.maxConcurrency, "]");
+
+  maxConcurrency = std::max(1, gateway->sessionStartLimit.maxConcurrency);
+  identifyQueues.assign(maxConcurrency, {});
+  nextIdentify.assign(maxConcurrency, {});
 
-  std::cout << "[Discord] Gateway: " << gateway->url << ", shard: " << gateway->shards << '\n';
-  std::cout << "[Discord] SessionStartLimit ["
-    << "total: " << gateway->sessionStartLimit.total << ", "
-    << "remaining: " << gateway->sessionStartLimit.remaining << ", "
-    << "resetAfter: " << gateway->sessionStartLimit.resetAfter << ", "
-    << "maxConcurrency: " << gateway->sessionStartLimit.maxConcurrency << "]\n";
+  int count = settings.shards > 0 ? settings.shards : std::max(1, gateway->shards);
 
-  session->run(*gateway, boost::bind(&Bot::onSessionData, this, _1));
+  if (count > gateway->sessionStartLimit.remaining) {
+    log::warn(log::subsystem::discord, "Starting ", count, " shards with only ",
+        gateway->sessionStartLimit.remaining, " session starts remaining");
+  }
+
+  for (int id = 0; id < count; ++id) {
+    shards.push_back(std::make_unique<Shard>(io, ctx, timers, *this, settings, *gateway, id, count));
+    shards.back()->run();
+  }
 }
 
 } // namespace discord
@@ -1,62 +1,102 @@
 #pragma once
 
-#include "request.hpp"
-#include "session.hpp"
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+
+#include "event.hpp"
+#include "cache.hpp"
+#include "rest.hpp"
+#include "settings.hpp"
+#include "shard.hpp"
 #include "user.hpp"
 
 namespace dc {
 
 namespace discord {
 
-struct Settings {
-  bool enabled;
-  std::string token;
-};
+/*
+ * Owns the gateway shards. Identifies are queued per max_concurrency bucket
+ * and released one bucket slot every identifyInterval, as Discord requires.
+ */
+class Bot {
+public:
+  using event_handler = std::function<void(const json::value& data)>;
 
-Settings tag_invoke(json::value_to_tag<Settings>, const json::value& jv);
+private:
+  static constexpr auto identifyInterval = std::chrono::seconds(5);
 
-class Bot {
   asio::io_context& io;
   ssl::context& ctx;
+  timer_service& timers;
+  io_strand strand;
   Settings settings;
+  std::shared_ptr<Rest> rest;
   std::optional<Gateway> gateway;
-  std::shared_ptr<Session> session;
-  std::string session_id;
-  bool identified{ false };
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  int maxConcurrency{ 1 };
+  std::vector<std::deque<Shard*>> identifyQueues;
+  std::vector<std::chrono::steady_clock::time_point> nextIdentify;
+  asio::steady_timer identifyTimer;
+  bool identifyArmed{ false };
+
+  std::shared_mutex handlersMutex;
+  std::unordered_map<std::uint32_t, std::vector<event_handler>> handlers;
 
-  std::unique_ptr<boost::asio::steady_timer> heartbeat;
-  std::chrono::milliseconds heartrate;
-  int needAck{ 0 };
-  int sequence{ -1 };
+  Cache cache;
 
+  std::mutex meMutex;
   std::optional<User> me;
 
 public:
-  Bot(asio::io_context& io, ssl::context& ctx, const Settings& settings)
+  Bot(asio::io_context& io, ssl::context& ctx, timer_service& timers, const Settings& settings)
     : io(io)
     , ctx(ctx)
+    , timers(timers)
+    , strand(io.get_executor())
     , settings(settings)
-  {}
+    , rest(std::make_shared<Rest>(io, ctx, "discord.com", settings.token))
+    , identifyTimer(strand)
+    , cache(static_cast<std::size_t>(settings.cacheSize) << 20)
+  {
+    registerCacheHandlers();
+  }
 
   void run();
   void reconnect();
 
   void createChannelMessage(size_t channel, const std::string& message);
 
+  // Completes with the created message object
+  template <class CompletionToken>
+    auto asyncCreateChannelMessage(size_t channel, const std::string& message, CompletionToken&& token) {
+      std::string endpoint{ "/api/v8/channels/" };
+      endpoint += std::to_string(channel);
+      endpoint += "/messages";
+
+      json::object payload{
+        { "content", message }
+      };
+
+      return rest->asyncPost(std::move(endpoint), json::serialize(payload),
+          std::forward<CompletionToken>(token));
+    }
+
+  Cache& getCache() { return cache; }
+
+  // Events nobody registered for are never parsed past their envelope
+  void registerHandler(Event event, event_handler handler);
+
+  // Called by shards, from their own strands
+  void requestIdentify(Shard& shard);
+  bool wants(std::string_view event);
+  void onDispatch(Shard& shard, std::string_view event, const json::value& data);
+
 private:
-  void onSessionData(const json::value& data);
-  void onDisconnect();
-
-  void onDispatch(const std::string& event, const json::value& data);
-  void onReconnect();
-  void onInvalidSession();
-  void onHello(int heartbeatInterval);
-  void onReady(const json::value& data);
-
-  void sendHeartbeat(const boost::system::error_code& ec);
-  void sendIdentify();
-  void sendResume();
-  void send(OpCode op, const json::value& data);
+  void registerCacheHandlers();
+  void pumpIdentify();
+  void onReady(Shard& shard, const json::value& data);
 
   void updateGateway();
   void onGatewayUpdated(const beast::error_code& ec, const json::value& data);
@@ -0,0 +1,364 @@
+#include "cache.hpp"
+
+#include <charconv>
+
+namespace dc {
+
+namespace discord {
+
+namespace {
+
+  std::uint64_t toId(const json::value* value) {
+    if (!value)
+      return 0;
+
+    auto string = value->if_string();
+    if (!string)
+      return 0;
+
+    std::uint64_t id{ 0 };
+    std::from_chars(string->data(), string->data() + string->size(), id);
+    return id;
+  }
+
+  std::uint64_t idOf(const json::object& object, json::string_view key) {
+    auto it = object.find(key);
+    return it != object.end() ? toId(&it->value()) : 0;
+  }
+
+  std::string_view stringOf(const json::object& object, json::string_view key) {
+    auto it = object.find(key);
+    if (it == object.end())
+      return {};
+
+    auto string = it->value().if_string();
+    return string ? std::string_view{ string->data(), string->size() } : std::string_view{};
+  }
+
+  const json::array* arrayOf(const json::object& object, json::string_view key) {
+    auto it = object.find(key);
+    return it != object.end() ? it->value().if_array() : nullptr;
+  }
+
+  const json::object* objectOf(const json::object& object, json::string_view key) {
+    auto it = object.find(key);
+    return it != object.end() ? it->value().if_object() : nullptr;
+  }
+
+} // namespace
+
+void Cache::onGuildCreate(const json::value& data) {
+  const auto& object = data.as_object();
+  auto id = idOf(object, "id");
+  if (!id)
+    return;
+
+  std::lock_guard lock{ mutex };
+
+  updateGuild(id, object);
+
+  if (auto list = arrayOf(object, "channels")) {
+    for (const auto& channel: *list) {
+      if (auto channelObject = channel.if_object())
+        updateChannel(id, *channelObject);
+    }
+  }
+
+  if (auto list = arrayOf(object, "members")) {
+    for (const auto& member: *list) {
+      if (auto memberObject = member.if_object())
+        updateMember(id, *memberObject);
+    }
+  }
+
+  evict();
+}
+
+void Cache::onGuildUpdate(const json::value& data) {
+  const auto& object = data.as_object();
+  auto id = idOf(object, "id");
+  if (!id)
+    return;
+
+  std::lock_guard lock{ mutex };
+  updateGuild(id, object);
+}
+
+void Cache::onGuildDelete(const json::value& data) {
+  auto id = idOf(data.as_object(), "id");
+
+  std::lock_guard lock{ mutex };
+
+  if (auto guild = guilds.find(id)) {
+    strings.release(guild->name);
+    guilds.erase(id);
+  }
+
+  for (std::size_t i = 0; i < channels.slotCount();) {
+    auto& slot = channels.slotAt(i);
+    if (slot.used && slot.value.guild == id) {
+      strings.release(slot.value.name);
+      channels.eraseAt(i);
+    } else {
+      ++i;
+    }
+  }
+
+  for (std::size_t i = 0; i < members.slotCount();) {
+    auto& slot = members.slotAt(i);
+    if (slot.used && slot.key.guild == id)
+      eraseMemberAt(i);
+    else
+      ++i;
+  }
+}
+
+void Cache::onChannelUpdate(const json::value& data) {
+  const auto& object = data.as_object();
+
+  std::lock_guard lock{ mutex };
+  updateChannel(idOf(object, "guild_id"), object);
+}
+
+void Cache::onChannelDelete(const json::value& data) {
+  auto id = idOf(data.as_object(), "id");
+
+  std::lock_guard lock{ mutex };
+
+  if (auto channel = channels.find(id)) {
+    strings.release(channel->name);
+    channels.erase(id);
+  }
+}
+
+void Cache::onMemberUpdate(const json::value& data) {
+  const auto& object = data.as_object();
+
+  std::lock_guard lock{ mutex };
+  updateMember(idOf(object, "guild_id"), object);
+  evict();
+}
+
+void Cache::onMemberRemove(const json::value& data) {
+  const auto& object = data.as_object();
+  auto user = objectOf(object, "user");
+  if (!user)
+    return;
+
+  std::lock_guard lock{ mutex };
+  removeMember({ idOf(object, "guild_id"), idOf(*user, "id") });
+}
+
+void Cache::onMembersChunk(const json::value& data) {
+  const auto& object = data.as_object();
+  auto guild = idOf(object, "guild_id");
+
+  std::lock_guard lock{ mutex };
+
+  if (auto list = arrayOf(object, "members")) {
+    for (const auto& member: *list) {
+      if (auto memberObject = member.if_object())
+        updateMember(guild, *memberObject);
+    }
+  }
+
+  evict();
+}
+
+std::optional<std::string> Cache::guildName(Snowflake guild) const {
+  std::lock_guard lock{ mutex };
+
+  auto found = guilds.find(guild.id);
+  if (!found)
+    return std::nullopt;
+  return std::string{ strings.get(found->name) };
+}
+
+std::optional<std::string> Cache::channelName(Snowflake channel) const {
+  std::lock_guard lock{ mutex };
+
+  auto found = channels.find(channel.id);
+  if (!found)
+    return std::nullopt;
+  return std::string{ strings.get(found->name) };
+}
+
+std::optional<std::string> Cache::userName(Snowflake user) const {
+  std::lock_guard lock{ mutex };
+
+  auto found = users.find(user.id);
+  if (!found)
+    return std::nullopt;
+  return std::string{ strings.get(found->username) };
+}
+
+std::optional<std::string> Cache::displayName(Snowflake guild, Snowflake user) {
+  std::lock_guard lock{ mutex };
+
+  auto member = members.find({ guild.id, user.id });
+  auto found = users.find(user.id);
+  if (!member || !found)
+    return std::nullopt;
+
+  member->referenced = true;
+  return std::string{ strings.get(member->nick ? member->nick : found->username) };
+}
+
+Cache::Stats Cache::getStats() const {
+  std::lock_guard lock{ mutex };
+
+  return {
+    guilds.size(),
+    channels.size(),
+    users.size(),
+    members.size(),
+    strings.size(),
+    memoryUsage(),
+    evicted
+  };
+}
+
+void Cache::updateGuild(std::uint64_t id, const json::object& object) {
+  auto& guild = guilds[id];
+
+  if (object.count("name"))
+    assign(guild.name, stringOf(object, "name"));
+  if (object.count("owner_id"))
+    guild.owner = idOf(object, "owner_id");
+
+  auto count = object.find("member_count");
+  if (count != object.end() && count->value().is_int64())
+    guild.memberCount = static_cast<std::uint32_t>(count->value().as_int64());
+}
+
+void Cache::updateChannel(std::uint64_t guild, const json::object& object) {
+  auto id = idOf(object, "id");
+  if (!id)
+    return;
+
+  auto& channel = channels[id];
+  if (guild)
+    channel.guild = guild;
+  assign(channel.name, stringOf(object, "name"));
+
+  auto type = object.find("type");
+  if (type != object.end() && type->value().is_int64())
+    channel.type = static_cast<std::uint8_t>(type->value().as_int64());
+}
+
+void Cache::updateMember(std::uint64_t guild, const json::object& object) {
+  auto user = objectOf(object, "user");
+  if (!guild || !user)
+    return;
+
+  auto id = updateUser(*user);
+  if (!id)
+    return;
+
+  MemberKey key{ guild, id };
+  auto member = members.find(key);
+  if (!member) {
+    member = &members[key];
+    users.find(id)->members++;
+  }
+
+  assign(member->nick, stringOf(object, "nick"));
+  member->referenced = true;
+}
+
+std::uint64_t Cache::updateUser(const json::object& object) {
+  auto id = idOf(object, "id");
+  if (!id)
+    return 0;
+
+  auto& user = users[id];
+
+  if (object.count("username"))
+    assign(user.username, stringOf(object, "username"));
+
+  auto discriminator = stringOf(object, "discriminator");
+  std::from_chars(discriminator.data(), discriminator.data() + discriminator.size(), user.discriminator);
+
+  auto bot = object.find("bot");
+  if (bot != object.end() && bot->value().is_bool())
+    user.bot = bot->value().as_bool();
+
+  return id;
+}
+
+void Cache::removeMember(const MemberKey& key) {
+  auto member = members.find(key);
+  if (!member)
+    return;
+
+  strings.release(member->nick);
+  members.erase(key);
+  releaseUser(key.user);
+}
+
+void Cache::eraseMemberAt(std::size_t index) {
+  auto& slot = members.slotAt(index);
+  auto user = slot.key.user;
+
+  strings.release(slot.value.nick);
+  members.eraseAt(index);
+  releaseUser(user);
+}
+
+void Cache::releaseUser(std::uint64_t id) {
+  auto user = users.find(id);
+  if (!user || --user->members > 0)
+    return;
+
+  strings.release(user->username);
+  users.erase(id);
+}
+
+void Cache::assign(Interner::Id& id, std::string_view text) {
+  if (strings.get(id) == text)
+    return;
+
+  auto next = strings.intern(text);
+  strings.release(id);
+  id = next;
+}
+
+std::size_t Cache::memoryUsage() const {
+  return strings.memoryUsage()
+    + guilds.memoryUsage()
+    + channels.memoryUsage()
+    + users.memoryUsage()
+    + members.memoryUsage();
+}
+
+std::size_t Cache::liveMemory() const {
+  return strings.memoryUsage()
+    + guilds.liveMemory()
+    + channels.liveMemory()
+    + users.liveMemory()
+    + members.liveMemory();
+}
+
+void Cache::evict() {
+  // Bounded so a cap below the fixed overhead can't spin forever
+  auto budget = members.slotCount() * 2;
+
+  while (liveMemory() > maxMemory && !members.empty() && budget-- > 0) {
+    hand %= members.slotCount();
+
+    auto& slot = members.slotAt(hand);
+    if (!slot.used) {
+      ++hand;
+    } else if (slot.value.referenced) {
+      slot.value.referenced = false;
+      ++hand;
+    } else {
+      eraseMemberAt(hand);
+      ++evicted;
+    }
+  }
+}
+
+} // namespace discord
+
+} // namespace dc
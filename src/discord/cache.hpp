@@ -0,0 +1,121 @@
+#pragma once
+
+#include <mutex>
+
+#include "flat_map.hpp"
+#include "interner.hpp"
+#include "snowflake.hpp"
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * In-memory copy of the guilds, channels, users and members the gateway
+ * has told us about, kept up to date from dispatch events. Members are
+ * evicted with a CLOCK sweep once the live entries grow past the memory
+ * cap; the tables themselves then stop growing.
+ */
+class Cache {
+public:
+  struct Stats {
+    std::size_t guilds;
+    std::size_t channels;
+    std::size_t users;
+    std::size_t members;
+    std::size_t strings;
+    std::size_t memory;
+    std::uint64_t evicted;
+  };
+
+private:
+  struct Guild {
+    Interner::Id name{ 0 };
+    std::uint64_t owner{ 0 };
+    std::uint32_t memberCount{ 0 };
+  };
+
+  struct Channel {
+    std::uint64_t guild{ 0 };
+    Interner::Id name{ 0 };
+    std::uint8_t type{ 0 };
+  };
+
+  struct User {
+    Interner::Id username{ 0 };
+    std::uint16_t discriminator{ 0 };
+    bool bot{ false };
+    std::uint32_t members{ 0 };
+  };
+
+  struct Member {
+    Interner::Id nick{ 0 };
+    bool referenced{ false };
+  };
+
+  struct MemberKey {
+    std::uint64_t guild{ 0 };
+    std::uint64_t user{ 0 };
+
+    bool operator==(const MemberKey& other) const {
+      return guild == other.guild && user == other.user;
+    }
+  };
+
+  struct MemberHash {
+    std::size_t operator()(const MemberKey& key) const {
+      return static_cast<std::size_t>(key.guild * 31 ^ key.user);
+    }
+  };
+
+  std::size_t maxMemory;
+
+  mutable std::mutex mutex;
+  Interner strings;
+  FlatMap<std::uint64_t, Guild> guilds;
+  FlatMap<std::uint64_t, Channel> channels;
+  FlatMap<std::uint64_t, User> users;
+  FlatMap<MemberKey, Member, MemberHash> members;
+  std::size_t hand{ 0 };
+  std::uint64_t evicted{ 0 };
+
+public:
+  explicit Cache(std::size_t maxMemory)
+    : maxMemory(maxMemory)
+  {}
+
+  void onGuildCreate(const json::value& data);
+  void onGuildUpdate(const json::value& data);
+  void onGuildDelete(const json::value& data);
+  void onChannelUpdate(const json::value& data);
+  void onChannelDelete(const json::value& data);
+  void onMemberUpdate(const json::value& data);
+  void onMemberRemove(const json::value& data);
+  void onMembersChunk(const json::value& data);
+
+  std::optional<std::string> guildName(Snowflake guild) const;
+  std::optional<std::string> channelName(Snowflake channel) const;
+  std::optional<std::string> userName(Snowflake user) const;
+  std::optional<std::string> displayName(Snowflake guild, Snowflake user);
+
+  Stats getStats() const;
+
+private:
+  void updateGuild(std::uint64_t id, const json::object& object);
+  void updateChannel(std::uint64_t guild, const json::object& object);
+  void updateMember(std::uint64_t guild, const json::object& object);
+  std::uint64_t updateUser(const json::object& object);
+  void removeMember(const MemberKey& key);
+  void eraseMemberAt(std::size_t index);
+  void releaseUser(std::uint64_t id);
+
+  void assign(Interner::Id& id, std::string_view text);
+
+  std::size_t memoryUsage() const;
+  std::size_t liveMemory() const;
+  void evict();
+};
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,157 @@
+#include "connection.hpp"
+
+#include "../log.hpp"
+
+namespace dc {
+
+namespace discord {
+
+namespace {
+
+bool isIdempotent(http::verb method) {
+  switch (method) {
+  case http::verb::get:
+  case http::verb::head:
+  case http::verb::put:
+  case http::verb::delete_:
+  case http::verb::options:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+void Connection::perform(Request request, callback handler) {
+  this->request = std::move(request);
+  this->handler = std::move(handler);
+  busy = true;
+  retried = !connected;
+
+  if (connected)
+    write();
+  else
+    connect();
+}
+
+void Connection::connect() {
+  connected = false;
+  stream = std::make_shared<Stream>(strand, ctx);
+
+  if (!SSL_set_tlsext_host_name(stream->native_handle(), host.c_str())) {
+    beast::error_code ec{ static_cast<int>(::ERR_get_error()), asio::error::get_ssl_category() };
+    log::error(log::subsystem::discord, "SSL Error: ", ec.message());
+    return fail(ec);
+  }
+
+  resolver.async_resolve(host, port,
+      beast::bind_front_handler(&Connection::onResolve, shared_from_this()));
+}
+
+void Connection::write() {
+  buffer.clear();
+  response = {};
+  sent = false;
+
+  beast::get_lowest_layer(*stream).expires_after(std::chrono::seconds(30));
+
+  http::async_write(*stream, request,
+      beast::bind_front_handler(&Connection::onWrite, shared_from_this()));
+}
+
+void Connection::fail(beast::error_code ec) {
+  if (connected && !retried && (!sent || isIdempotent(request.method()))) {
+    retried = true;
+    connect();
+    return;
+  }
+
+  close();
+  busy = false;
+
+  auto done = std::move(handler);
+  done(ec, response);
+}
+
+void Connection::close() {
+  connected = false;
+
+  if (!stream)
+    return;
+
+  auto old = std::move(stream);
+  beast::get_lowest_layer(*old).expires_after(std::chrono::seconds(5));
+  old->async_shutdown(
+      [old](beast::error_code ec) {
+        if (ec == asio::error::eof || ec == ssl::error::stream_truncated)
+          ec = {};
+
+        if (ec)
+          log::error(log::subsystem::discord, "Connection shutdown failed: ", ec.message());
+      });
+}
+
+void Connection::onResolve(beast::error_code ec, tcp::resolver::results_type results) {
+  if (ec)
+    return fail(ec);
+
+  beast::get_lowest_layer(*stream).expires_after(std::chrono::seconds(30));
+
+  beast::get_lowest_layer(*stream).async_connect(results,
+      beast::bind_front_handler(&Connection::onConnect, shared_from_this()));
+}
+
+void Connection::onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type endpoint) {
+  boost::ignore_unused(endpoint);
+
+  if (ec)
+    return fail(ec);
+
+  beast::get_lowest_layer(*stream).expires_after(std::chrono::seconds(30));
+
+  stream->async_handshake(ssl::stream_base::client,
+      beast::bind_front_handler(&Connection::onHandshake, shared_from_this()));
+}
+
+void Connection::onHandshake(beast::error_code ec) {
+  if (ec)
+    return fail(ec);
+
+  connected = true;
+  retried = true;
+
+  write();
+}
+
+void Connection::onWrite(beast::error_code ec, std::size_t bytes) {
+  if (bytes > 0)
+    sent = true;
+
+  if (ec)
+    return fail(ec);
+
+  http::async_read(*stream, buffer, response,
+      beast::bind_front_handler(&Connection::onRead, shared_from_this()));
+}
+
+void Connection::onRead(beast::error_code ec, std::size_t bytes) {
+  boost::ignore_unused(bytes);
+
+  if (ec)
+    return fail(ec);
+
+  beast::get_lowest_layer(*stream).expires_never();
+
+  if (!response.keep_alive())
+    close();
+
+  busy = false;
+
+  auto done = std::move(handler);
+  done(ec, response);
+}
+
+} // namespace discord
+
+} // namespace dc
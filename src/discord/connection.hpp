@@ -0,0 +1,68 @@
+#pragma once
+
+#include "../common.hpp"
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * A persistent HTTP/1.1 connection to a single host. Requests are written
+ * one at a time over the same TLS stream; if a reused connection turns out
+ * to have been closed by the server, it reconnects and retries once. A
+ * request that may already have reached the server is only retried when
+ * its method is idempotent, so a POST is never delivered twice.
+ */
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+  using Stream = beast::ssl_stream<beast::tcp_stream>;
+  using Request = http::request<http::string_body>;
+  using Response = http::response<http::string_body>;
+  using callback = std::function<void(const beast::error_code& ec, Response& response)>;
+
+private:
+  io_strand strand;
+  ssl::context& ctx;
+  tcp::resolver resolver;
+  std::shared_ptr<Stream> stream;
+  beast::flat_buffer buffer;
+  Request request;
+  Response response;
+  std::string host;
+  std::string port{ "443" };
+  callback handler;
+  bool connected{ false };
+  bool busy{ false };
+  bool retried{ false };
+  // Some of the request was written on the current attempt
+  bool sent{ false };
+
+public:
+  Connection(const io_strand& strand, ssl::context& ctx, std::string host)
+    : strand(strand)
+    , ctx(ctx)
+    , resolver(strand)
+    , host(std::move(host))
+  {}
+
+  void perform(Request request, callback handler);
+
+  bool isBusy() const { return busy; }
+  bool isConnected() const { return connected; }
+
+private:
+  void connect();
+  void write();
+  void fail(beast::error_code ec);
+  void close();
+
+  void onResolve(beast::error_code ec, tcp::resolver::results_type results);
+  void onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type endpoint);
+  void onHandshake(beast::error_code ec);
+  void onWrite(beast::error_code ec, std::size_t bytes);
+  void onRead(beast::error_code ec, std::size_t bytes);
+};
+
+} // namespace discord
+
+} // namespace dc
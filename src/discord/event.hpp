@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace dc {
 
@@ -23,8 +24,13 @@ constexpr std::uint32_t operator"" _hash(char const* s, std::size_t count) {
   return detail::fnv1a_32(s, count);
 }
 
-std::uint32_t fnv1a_32(const std::string& s) {
-  return detail::fnv1a_32(s.c_str(), s.length());
+// Matches `_hash`, which also folds in the terminating NUL, without
+// reading past the end of the view.
+inline std::uint32_t fnv1a_32(std::string_view s) {
+  std::uint32_t hash = 2166136261u;
+  for (char c: s)
+    hash = (hash ^ c) * 16777619u;
+  return hash * 16777619u;
 }
 
 enum class Event: std::uint32_t {
@@ -33,6 +39,17 @@ enum class Event: std::uint32_t {
 
   MessageCreate = "MESSAGE_CREATE"_hash,
   MessageUpdate = "MESSAGE_UPDATE"_hash,
+
+  GuildCreate       = "GUILD_CREATE"_hash,
+  GuildUpdate       = "GUILD_UPDATE"_hash,
+  GuildDelete       = "GUILD_DELETE"_hash,
+  ChannelCreate     = "CHANNEL_CREATE"_hash,
+  ChannelUpdate     = "CHANNEL_UPDATE"_hash,
+  ChannelDelete     = "CHANNEL_DELETE"_hash,
+  GuildMemberAdd    = "GUILD_MEMBER_ADD"_hash,
+  GuildMemberUpdate = "GUILD_MEMBER_UPDATE"_hash,
+  GuildMemberRemove = "GUILD_MEMBER_REMOVE"_hash,
+  GuildMembersChunk = "GUILD_MEMBERS_CHUNK"_hash,
 };
 
 } // namespace discord
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * Open-addressing hash map with linear probing and backward-shift deletion,
+ * so entries live inline in one array with no per-node allocation or
+ * tombstones. Slots are exposed by index for clock style sweeps.
+ */
+template <class Key, class Value, class Hash = std::hash<Key>>
+class FlatMap {
+public:
+  struct Slot {
+    Key key{};
+    Value value{};
+    bool used{ false };
+  };
+
+private:
+  std::vector<Slot> slots;
+  std::size_t count{ 0 };
+
+  static std::size_t mix(std::uint64_t h) {
+    // splitmix64 finalizer; snowflakes keep most of their entropy high
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return static_cast<std::size_t>(h);
+  }
+
+  std::size_t home(const Key& key) const {
+    return mix(Hash{}(key)) & (slots.size() - 1);
+  }
+
+  std::size_t locate(const Key& key) const {
+    if (slots.empty())
+      return npos;
+
+    for (auto i = home(key);; i = (i + 1) & (slots.size() - 1)) {
+      if (!slots[i].used)
+        return npos;
+      if (slots[i].key == key)
+        return i;
+    }
+  }
+
+  void grow() {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.resize(old.empty() ? 16 : old.size() * 2);
+    count = 0;
+
+    for (auto& slot: old) {
+      if (slot.used)
+        (*this)[slot.key] = std::move(slot.value);
+    }
+  }
+
+public:
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  Value* find(const Key& key) {
+    auto i = locate(key);
+    return i == npos ? nullptr : &slots[i].value;
+  }
+
+  const Value* find(const Key& key) const {
+    auto i = locate(key);
+    return i == npos ? nullptr : &slots[i].value;
+  }
+
+  Value& operator[](const Key& key) {
+    if ((count + 1) * 10 > slots.size() * 7)
+      grow();
+
+    auto i = home(key);
+    for (; slots[i].used; i = (i + 1) & (slots.size() - 1)) {
+      if (slots[i].key == key)
+        return slots[i].value;
+    }
+
+    slots[i].key = key;
+    slots[i].used = true;
+    ++count;
+    return slots[i].value;
+  }
+
+  bool erase(const Key& key) {
+    auto i = locate(key);
+    if (i == npos)
+      return false;
+
+    eraseAt(i);
+    return true;
+  }
+
+  // Later entries of the probe chain may shift into `index`, so a sweep
+  // should look at the same index again afterwards.
+  void eraseAt(std::size_t index) {
+    auto mask = slots.size() - 1;
+    auto i = index;
+
+    for (auto j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+      auto k = home(slots[j].key);
+      bool between = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+      if (between)
+        continue;
+
+      slots[i] = std::move(slots[j]);
+      i = j;
+    }
+
+    slots[i] = Slot{};
+    --count;
+  }
+
+  template <class F>
+  void forEach(F&& f) {
+    for (auto& slot: slots) {
+      if (slot.used)
+        f(slot.key, slot.value);
+    }
+  }
+
+  Slot& slotAt(std::size_t index) { return slots[index]; }
+  std::size_t slotCount() const { return slots.size(); }
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  std::size_t memoryUsage() const { return slots.capacity() * sizeof(Slot); }
+  std::size_t liveMemory() const { return count * sizeof(Slot); }
+
+  void clear() {
+    slots.clear();
+    slots.shrink_to_fit();
+    count = 0;
+  }
+};
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,155 @@
+#include "frame.hpp"
+
+#include <charconv>
+
+namespace dc {
+
+namespace discord {
+
+namespace {
+
+  void skipSpace(std::string_view s, std::size_t& pos) {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+      ++pos;
+  }
+
+  // Leaves pos after the closing quote and returns the contents, escapes
+  // included.
+  bool skipString(std::string_view s, std::size_t& pos, std::string_view& out) {
+    if (pos >= s.size() || s[pos] != '"')
+      return false;
+
+    auto start = ++pos;
+    while (pos < s.size()) {
+      if (s[pos] == '\\') {
+        pos += 2;
+      } else if (s[pos] == '"') {
+        out = s.substr(start, pos - start);
+        ++pos;
+        return true;
+      } else {
+        ++pos;
+      }
+    }
+
+    return false;
+  }
+
+  bool skipValue(std::string_view s, std::size_t& pos) {
+    skipSpace(s, pos);
+    if (pos >= s.size())
+      return false;
+
+    std::string_view ignored;
+
+    if (s[pos] == '"')
+      return skipString(s, pos, ignored);
+
+    if (s[pos] != '{' && s[pos] != '[') {
+      while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']'
+          && s[pos] != ' ' && s[pos] != '\n' && s[pos] != '\r' && s[pos] != '\t')
+        ++pos;
+      return true;
+    }
+
+    int depth = 0;
+    while (pos < s.size()) {
+      switch (s[pos]) {
+        case '"':
+          if (!skipString(s, pos, ignored))
+            return false;
+          continue;
+        case '{':
+        case '[':
+          ++depth;
+          break;
+        case '}':
+        case ']':
+          if (--depth == 0) {
+            ++pos;
+            return true;
+          }
+          break;
+        default:
+          break;
+      }
+      ++pos;
+    }
+
+    return false;
+  }
+
+  std::optional<int> toInt(std::string_view value) {
+    int result;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc{} || end != value.data() + value.size())
+      return std::nullopt;
+    return result;
+  }
+
+} // namespace
+
+bool scan(std::string_view payload, Frame& frame) {
+  frame = Frame{};
+
+  std::size_t pos = 0;
+  skipSpace(payload, pos);
+  if (pos >= payload.size() || payload[pos] != '{')
+    return false;
+  ++pos;
+
+  bool sawOp = false;
+
+  while (true) {
+    skipSpace(payload, pos);
+    if (pos < payload.size() && payload[pos] == '}')
+      break;
+
+    std::string_view key;
+    if (!skipString(payload, pos, key))
+      return false;
+
+    skipSpace(payload, pos);
+    if (pos >= payload.size() || payload[pos] != ':')
+      return false;
+    ++pos;
+
+    skipSpace(payload, pos);
+    auto start = pos;
+    if (!skipValue(payload, pos))
+      return false;
+    auto value = payload.substr(start, pos - start);
+
+    if (key == "op") {
+      auto op = toInt(value);
+      if (!op)
+        return false;
+      frame.op = static_cast<OpCode>(*op);
+      sawOp = true;
+    } else if (key == "s") {
+      frame.sequence = toInt(value);
+    } else if (key == "t") {
+      if (value.size() >= 2 && value.front() == '"')
+        frame.event = value.substr(1, value.size() - 2);
+    } else if (key == "d") {
+      frame.raw = value;
+    }
+
+    skipSpace(payload, pos);
+    if (pos < payload.size() && payload[pos] == ',') {
+      ++pos;
+      continue;
+    }
+
+    if (pos < payload.size() && payload[pos] == '}')
+      break;
+
+    return false;
+  }
+
+  return sawOp;
+}
+
+} // namespace discord
+
+} // namespace dc
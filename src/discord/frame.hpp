@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../common.hpp"
+
+namespace dc {
+
+namespace discord {
+
+enum class OpCode {
+  Dispatch            = 0,
+  Heartbeat           = 1,
+  Identify            = 2,
+  PresenceUpdate      = 3,
+  VoiceStateUpdate    = 4,
+  Resume              = 6,
+  Reconnect           = 7,
+  RequestGuildMembers = 8,
+  InvalidSession      = 9,
+  Hello               = 10,
+  HeartbeatAck        = 11,
+};
+
+/*
+ * A gateway payload with only its envelope decoded. `raw` is the unparsed
+ * text of `d`; `data` is only set once something decided to parse it. All
+ * views point into the frame that was scanned.
+ *
+ * https://discord.com/developers/docs/topics/gateway#payloads
+ */
+struct Frame {
+  OpCode op{ OpCode::Dispatch };
+  std::optional<int> sequence;
+  std::string_view event;
+  std::string_view raw;
+  const json::value* data{ nullptr };
+};
+
+bool scan(std::string_view payload, Frame& frame);
+
+} // namespace discord
+
+} // namespace dc
@@ -4,23 +4,23 @@ namespace dc {
 
 namespace discord {
 
-SessionStartLimit tag_invoke(json::value_to_tag<SessionStartLimit>, const json::value& jv) {
-  SessionStartLimit s;
-  const json::object& obj = jv.as_object();
-  extract(obj, s.total, "total");
-  extract(obj, s.remaining, "remaining");
-  extract(obj, s.resetAfter, "reset_after");
-  extract(obj, s.maxConcurrency, "max_concurrency");
-  return s;
+constexpr auto sessionStartLimitFields = std::make_tuple(
+    required("total", &SessionStartLimit::total),
+    required("remaining", &SessionStartLimit::remaining),
+    required("reset_after", &SessionStartLimit::resetAfter),
+    required("max_concurrency", &SessionStartLimit::maxConcurrency));
+
+constexpr auto gatewayFields = std::make_tuple(
+    required("url", &Gateway::url),
+    required("shards", &Gateway::shards),
+    required("session_start_limit", &Gateway::sessionStartLimit));
+
+std::error_code decode(const json::value& jv, SessionStartLimit& s) {
+  return decode_object(jv, s, sessionStartLimitFields);
 }
 
-Gateway tag_invoke(json::value_to_tag<Gateway>, const json::value& jv) {
-  Gateway g;
-  const json::object& obj = jv.as_object();
-  extract(obj, g.url, "url");
-  extract(obj, g.shards, "shards");
-  extract(obj, g.sessionStartLimit, "session_start_limit");
-  return g;
+std::error_code decode(const json::value& jv, Gateway& g) {
+  return decode_object(jv, g, gatewayFields);
 }
 
 } // namespace discord
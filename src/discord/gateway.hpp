@@ -19,8 +19,8 @@ struct Gateway {
   SessionStartLimit sessionStartLimit;
 };
 
-SessionStartLimit tag_invoke(json::value_to_tag<SessionStartLimit>, const json::value& jv);
-Gateway tag_invoke(json::value_to_tag<Gateway>, const json::value& jv);
+std::error_code decode(const json::value& jv, SessionStartLimit& s);
+std::error_code decode(const json::value& jv, Gateway& g);
 
 } // namespace discord
 
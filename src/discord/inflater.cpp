@@ -0,0 +1,69 @@
+#include "inflater.hpp"
+
+#include <cstring>
+
+namespace dc {
+
+namespace discord {
+
+namespace {
+
+constexpr char syncFlushSuffix[] = { '\x00', '\x00', '\xff', '\xff' };
+
+} // namespace
+
+Inflater::Inflater() {
+  if (inflateInit(&stream) != Z_OK)
+    throw std::runtime_error("Failed to initialize zlib stream");
+
+  output.resize(64 * 1024);
+}
+
+Inflater::~Inflater() {
+  inflateEnd(&stream);
+}
+
+std::optional<std::string_view> Inflater::feed(std::string_view message) {
+  bool complete = message.size() >= sizeof(syncFlushSuffix)
+    && std::memcmp(message.data() + message.size() - sizeof(syncFlushSuffix),
+        syncFlushSuffix, sizeof(syncFlushSuffix)) == 0;
+
+  if (!complete || !pending.empty()) {
+    pending.append(message);
+    if (!complete)
+      return std::nullopt;
+    message = pending;
+  }
+
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(message.data()));
+  stream.avail_in = static_cast<uInt>(message.size());
+
+  std::size_t produced = 0;
+  for (;;) {
+    if (produced == output.size())
+      output.resize(output.size() * 2);
+
+    stream.next_out = reinterpret_cast<Bytef*>(output.data() + produced);
+    stream.avail_out = static_cast<uInt>(output.size() - produced);
+
+    auto rc = inflate(&stream, Z_SYNC_FLUSH);
+    produced = output.size() - stream.avail_out;
+
+    if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) {
+      std::stringstream msg;
+      msg << "Inflate failed: " << (stream.msg ? stream.msg : "unknown error");
+      throw std::runtime_error(msg.str());
+    }
+
+    if (stream.avail_in == 0 && stream.avail_out != 0)
+      break;
+  }
+
+  pending.clear();
+
+  return std::string_view{ output.data(), produced };
+}
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <zlib.h>
+
+#include "../common.hpp"
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * Decompresses a zlib-stream gateway connection. One inflate context lives
+ * for the whole connection; a payload is complete once a message ends with
+ * the Z_SYNC_FLUSH suffix.
+ *
+ * https://discord.com/developers/docs/topics/gateway#transport-compression
+ */
+class Inflater {
+  z_stream stream{};
+  std::string pending;
+  std::string output;
+
+public:
+  Inflater();
+  ~Inflater();
+
+  Inflater(const Inflater&) = delete;
+  Inflater& operator=(const Inflater&) = delete;
+
+  std::optional<std::string_view> feed(std::string_view message);
+};
+
+} // namespace discord
+
+} // namespace dc
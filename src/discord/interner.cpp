@@ -0,0 +1,61 @@
+#include "interner.hpp"
+
+namespace dc {
+
+namespace discord {
+
+Interner::Interner() {
+  entries.emplace_back();
+}
+
+Interner::Id Interner::intern(std::string_view text) {
+  if (text.empty())
+    return 0;
+
+  auto it = index.find(text);
+  if (it != index.end()) {
+    entries[it->second].refs++;
+    return it->second;
+  }
+
+  Id id;
+  if (!unused.empty()) {
+    id = unused.back();
+    unused.pop_back();
+  } else {
+    id = static_cast<Id>(entries.size());
+    entries.emplace_back();
+  }
+
+  auto& entry = entries[id];
+  entry.text.assign(text);
+  entry.refs = 1;
+  bytes += entry.text.capacity();
+
+  index.emplace(entry.text, id);
+  return id;
+}
+
+void Interner::release(Id id) {
+  if (id == 0)
+    return;
+
+  auto& entry = entries[id];
+  if (--entry.refs > 0)
+    return;
+
+  index.erase(entry.text);
+  bytes -= entry.text.capacity();
+  entry.text.clear();
+  entry.text.shrink_to_fit();
+  unused.push_back(id);
+}
+
+std::size_t Interner::memoryUsage() const {
+  // Rough node overhead for the index, on top of the entries themselves
+  return bytes + entries.size() * sizeof(Entry) + index.size() * 48;
+}
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <deque>
+
+#include "../common.hpp"
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * Reference counted string pool. Cached entities store a 4 byte Id instead
+ * of a std::string, and names shared between entities are stored once.
+ * Id 0 is always the empty string.
+ */
+class Interner {
+public:
+  using Id = std::uint32_t;
+
+private:
+  struct Entry {
+    std::string text;
+    std::uint32_t refs{ 0 };
+  };
+
+  // A deque never moves its elements, so the views used as keys stay valid
+  std::deque<Entry> entries;
+  std::vector<Id> unused;
+  std::unordered_map<std::string_view, Id> index;
+  std::size_t bytes{ 0 };
+
+public:
+  Interner();
+
+  Id intern(std::string_view text);
+  void release(Id id);
+  std::string_view get(Id id) const { return entries[id].text; }
+
+  std::size_t size() const { return index.size(); }
+  std::size_t memoryUsage() const;
+};
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,178 @@
+#include "ratelimit.hpp"
+
+#include <cstdlib>
+
+namespace dc {
+
+namespace discord {
+
+namespace {
+
+bool isSnowflake(std::string_view segment) {
+  return !segment.empty() && segment.find_first_not_of("0123456789") == std::string_view::npos;
+}
+
+bool isMajorParameter(std::string_view previous) {
+  return previous == "channels" || previous == "guilds" || previous == "webhooks";
+}
+
+std::string_view majorParameter(std::string_view route) {
+  for (std::string_view prefix: { "/channels/", "/guilds/", "/webhooks/" }) {
+    auto start = route.find(prefix);
+    if (start == std::string_view::npos)
+      continue;
+
+    auto end = route.find('/', start + prefix.size());
+    return route.substr(start, end == std::string_view::npos ? end : end - start);
+  }
+
+  return {};
+}
+
+double toSeconds(beast::string_view value) {
+  return std::strtod(std::string{ value }.c_str(), nullptr);
+}
+
+} // namespace
+
+RateLimiter::RateLimiter()
+  : limitedTotal(metrics::global().get_counter("dc_discord_rest_limited_total", "REST requests answered with a 429", "scope=\"bucket\""))
+  , globalLimitedTotal(metrics::global().get_counter("dc_discord_rest_limited_total", "REST requests answered with a 429", "scope=\"global\""))
+  , inFlight(metrics::global().get_gauge("dc_discord_rest_in_flight", "REST requests waiting on a response"))
+{}
+
+RateLimiter::~RateLimiter() {
+  for (const auto& [key, bucket]: buckets)
+    inFlight.add(-bucket.inFlight);
+}
+
+std::string RateLimiter::route(http::verb method, std::string_view target) {
+  target = target.substr(0, target.find('?'));
+
+  std::string key{ http::to_string(method) };
+  key += ' ';
+
+  std::string_view previous;
+  while (!target.empty()) {
+    auto end = target.find('/', 1);
+    auto segment = target.substr(0, end);
+    target.remove_prefix(end == std::string_view::npos ? target.size() : end);
+
+    auto name = segment.substr(1);
+    if (isSnowflake(name) && !isMajorParameter(previous))
+      key += "/:id";
+    else
+      key += segment;
+
+    previous = name;
+  }
+
+  return key;
+}
+
+RateLimiter::Bucket& RateLimiter::bucketFor(const std::string& route) {
+  auto it = routes.find(route);
+  if (it == routes.end())
+    it = routes.emplace(route, route).first;
+
+  return buckets[it->second];
+}
+
+std::optional<RateLimiter::clock::time_point> RateLimiter::acquire(const std::string& route, clock::time_point now) {
+  if (now < globalUntil)
+    return globalUntil;
+
+  if (now - globalWindow >= std::chrono::seconds(1)) {
+    globalWindow = now;
+    globalCount = 0;
+  }
+
+  if (globalCount >= globalPerSecond)
+    return globalWindow + std::chrono::seconds(1);
+
+  auto& bucket = bucketFor(route);
+
+  if (bucket.limit < 0) {
+    if (bucket.inFlight > 0)
+      return std::nullopt;
+  } else {
+    if (now >= bucket.resetAt && bucket.remaining < bucket.limit)
+      bucket.remaining = bucket.limit;
+
+    if (bucket.remaining - bucket.inFlight <= 0) {
+      if (now < bucket.resetAt)
+        return bucket.resetAt;
+      if (bucket.inFlight > 0)
+        return std::nullopt;
+    }
+  }
+
+  bucket.inFlight++;
+  globalCount++;
+  inFlight.add(1);
+
+  return now;
+}
+
+void RateLimiter::release(const std::string& route) {
+  auto& bucket = bucketFor(route);
+  if (bucket.inFlight > 0) {
+    bucket.inFlight--;
+    inFlight.add(-1);
+  }
+}
+
+void RateLimiter::update(const std::string& route, const Header& header, clock::time_point now) {
+  release(route);
+
+  auto id = header["X-RateLimit-Bucket"];
+  if (!id.empty()) {
+    auto& key = routes[route];
+    std::string learned{ id };
+    learned += majorParameter(route);
+
+    if (key != learned) {
+      auto old = buckets.find(key);
+      auto& bucket = buckets[learned];
+      bucket.id = learned;
+      if (old != buckets.end() && old->first != learned) {
+        bucket.inFlight += old->second.inFlight;
+        buckets.erase(old);
+      }
+      key = learned;
+    }
+  }
+
+  auto& bucket = bucketFor(route);
+
+  auto limit = header["X-RateLimit-Limit"];
+  auto remaining = header["X-RateLimit-Remaining"];
+  auto resetAfter = header["X-RateLimit-Reset-After"];
+
+  if (!limit.empty())
+    bucket.limit = std::atoi(std::string{ limit }.c_str());
+  if (!remaining.empty())
+    bucket.remaining = std::atoi(std::string{ remaining }.c_str());
+  if (!resetAfter.empty())
+    bucket.resetAt = now + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(toSeconds(resetAfter)));
+
+  if (header.result() != http::status::too_many_requests)
+    return;
+
+  auto retryAfter = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(toSeconds(header[http::field::retry_after])));
+
+  if (header["X-RateLimit-Global"] == "true") {
+    globalLimitedTotal.add();
+    globalUntil = now + retryAfter;
+  } else {
+    limitedTotal.add();
+    bucket.remaining = 0;
+    bucket.resetAt = std::max(bucket.resetAt, now + retryAfter);
+  }
+}
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../common.hpp"
+#include "../metrics.hpp"
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * Tracks Discord's REST rate limits as reported by the X-RateLimit-*
+ * headers. Routes are mapped to the bucket the API reports for them; until
+ * a route's bucket is known only one request on it is let through at a
+ * time. 429s and in-flight requests are exported through the metrics
+ * registry.
+ *
+ * https://discord.com/developers/docs/topics/rate-limits
+ */
+class RateLimiter {
+public:
+  using clock = std::chrono::steady_clock;
+  using Header = http::response_header<>;
+
+  struct Bucket {
+    std::string id;
+    int limit{ -1 };
+    int remaining{ 1 };
+    int inFlight{ 0 };
+    clock::time_point resetAt{};
+  };
+
+private:
+  static constexpr int globalPerSecond = 50;
+
+  std::unordered_map<std::string, std::string> routes;
+  std::unordered_map<std::string, Bucket> buckets;
+  clock::time_point globalUntil{};
+  clock::time_point globalWindow{};
+  int globalCount{ 0 };
+
+  metrics::counter& limitedTotal;
+  metrics::counter& globalLimitedTotal;
+  metrics::gauge& inFlight;
+
+public:
+  RateLimiter();
+  ~RateLimiter();
+
+  static std::string route(http::verb method, std::string_view target);
+
+  // Reserves a slot on the route's bucket and returns `now`, or returns
+  // the time to try again. std::nullopt means the route waits for a
+  // request already in flight.
+  std::optional<clock::time_point> acquire(const std::string& route, clock::time_point now);
+  void update(const std::string& route, const Header& header, clock::time_point now);
+  void release(const std::string& route);
+
+private:
+  Bucket& bucketFor(const std::string& route);
+};
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,145 @@
+#include "rest.hpp"
+
+#include "../log.hpp"
+
+namespace dc {
+
+namespace discord {
+
+void Rest::get(const std::string& endpoint, callback handler) {
+  enqueue({ http::verb::get, endpoint, "", std::move(handler),
+      RateLimiter::route(http::verb::get, endpoint), 0 });
+}
+
+void Rest::post(const std::string& endpoint, const std::string& payload, callback handler) {
+  enqueue({ http::verb::post, endpoint, payload, std::move(handler),
+      RateLimiter::route(http::verb::post, endpoint), 0 });
+}
+
+void Rest::enqueue(Job job) {
+  asio::dispatch(strand,
+      [self = shared_from_this(), job = std::move(job)]() mutable {
+        auto route = job.route;
+        self->queues[route].push_back(std::move(job));
+        self->queued++;
+        self->queuedRequests.add(1);
+        self->pump();
+      });
+}
+
+void Rest::pump() {
+  auto now = clock::now();
+  auto wake = clock::time_point::max();
+
+  for (auto it = queues.begin(); it != queues.end();) {
+    auto& jobs = it->second;
+
+    while (!jobs.empty()) {
+      auto at = limiter.acquire(it->first, now);
+      if (!at)
+        break;
+
+      if (*at > now) {
+        wake = std::min(wake, *at);
+        break;
+      }
+
+      auto connection = acquire();
+      if (!connection) {
+        limiter.release(it->first);
+        return;
+      }
+
+      auto job = std::move(jobs.front());
+      jobs.pop_front();
+      queued--;
+      queuedRequests.add(-1);
+
+      start(connection, std::move(job));
+    }
+
+    if (jobs.empty())
+      it = queues.erase(it);
+    else
+      ++it;
+  }
+
+  if (wake != clock::time_point::max())
+    arm(wake);
+}
+
+void Rest::arm(clock::time_point when) {
+  if (armed && *armed <= when)
+    return;
+
+  armed = when;
+  timer.expires_at(when);
+  timer.async_wait(
+      [self = shared_from_this()](const beast::error_code& ec) {
+        if (ec)
+          return;
+
+        self->armed.reset();
+        self->pump();
+      });
+}
+
+std::shared_ptr<Connection> Rest::acquire() {
+  for (const auto& connection: connections) {
+    if (!connection->isBusy())
+      return connection;
+  }
+
+  if (connections.size() >= maxConnections)
+    return nullptr;
+
+  connections.push_back(std::make_shared<Connection>(strand, ctx, host));
+  return connections.back();
+}
+
+void Rest::start(const std::shared_ptr<Connection>& connection, Job job) {
+  Connection::Request request{ job.method, job.target, 11 };
+  request.set(http::field::host, host);
+  request.set(http::field::user_agent, "DiscordBot (https://github.com/pubis, 0.1)");
+  request.set(http::field::authorization, "Bot " + token);
+  request.set(http::field::content_type, "application/json");
+  request.keep_alive(true);
+  request.body() = job.body;
+  request.prepare_payload();
+
+  job.attempts++;
+  requestsTotal.add();
+
+  connection->perform(std::move(request),
+      [self = shared_from_this(), job = std::move(job)](
+          const beast::error_code& ec, Connection::Response& response) mutable {
+        if (ec) {
+          self->limiter.release(job.route);
+          job.handler(ec, nullptr);
+        } else {
+          self->limiter.update(job.route, response.base(), clock::now());
+
+          if (response.result() == http::status::too_many_requests && job.attempts < maxAttempts) {
+            log::warn(log::subsystem::discord, "Rate limited on ", job.route, ", retrying");
+            auto route = job.route;
+            self->queues[route].push_front(std::move(job));
+            self->queued++;
+            self->queuedRequests.add(1);
+          } else {
+            json::value data;
+            if (!response.body().empty()) {
+              json::error_code parseError;
+              data = json::parse(response.body(), parseError);
+            }
+
+            job.handler(ec, data);
+          }
+        }
+
+        asio::post(self->strand, [self] { self->pump(); });
+      });
+}
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../async.hpp"
+#include "connection.hpp"
+#include "ratelimit.hpp"
+
+namespace dc {
+
+namespace discord {
+
+/*
+ * REST client that keeps up to maxConnections persistent connections to
+ * the API host. Requests are queued per route and only sent once the
+ * route's rate limit bucket allows it; 429 responses are retried. Queue
+ * depth and requests sent are exported through the metrics registry.
+ */
+class Rest : public std::enable_shared_from_this<Rest> {
+  using callback = std::function<void(const beast::error_code& ec, const json::value& data)>;
+  using clock = RateLimiter::clock;
+
+  struct Job {
+    http::verb method;
+    std::string target;
+    std::string body;
+    callback handler;
+    std::string route;
+    int attempts{ 0 };
+  };
+
+  static constexpr int maxAttempts = 3;
+
+  io_strand strand;
+  ssl::context& ctx;
+  std::string host;
+  std::string token;
+  std::size_t maxConnections;
+  std::vector<std::shared_ptr<Connection>> connections;
+  std::unordered_map<std::string, std::deque<Job>> queues;
+  RateLimiter limiter;
+  asio::steady_timer timer;
+  std::optional<clock::time_point> armed;
+
+  metrics::counter& requestsTotal;
+  metrics::gauge& queuedRequests;
+  std::size_t queued{ 0 };
+
+public:
+  Rest(asio::io_context& io, ssl::context& ctx, std::string host, std::string token,
+      std::size_t maxConnections = 4)
+    : strand(io.get_executor())
+    , ctx(ctx)
+    , host(std::move(host))
+    , token(std::move(token))
+    , maxConnections(maxConnections)
+    , timer(strand)
+    , requestsTotal(metrics::global().get_counter("dc_discord_rest_requests_total", "REST requests sent"))
+    , queuedRequests(metrics::global().get_gauge("dc_discord_rest_queued_requests", "REST requests waiting on a rate limit or connection"))
+  {}
+
+  ~Rest() { queuedRequests.add(-static_cast<std::int64_t>(queued)); }
+
+  void get(const std::string& endpoint, callback handler);
+  void post(const std::string& endpoint, const std::string& payload, callback handler);
+
+  // Token based forms of get/post; with asio::use_awaitable an error is thrown
+  template <class CompletionToken>
+    auto asyncGet(std::string endpoint, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(beast::error_code, json::value)>(
+          [self = shared_from_this()](auto handler, std::string endpoint) {
+            self->get(endpoint,
+                make_completion<beast::error_code, json::value>(std::move(handler), self->strand));
+          }, token, std::move(endpoint));
+    }
+
+  template <class CompletionToken>
+    auto asyncPost(std::string endpoint, std::string payload, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(beast::error_code, json::value)>(
+          [self = shared_from_this()](auto handler, std::string endpoint, std::string payload) {
+            self->post(endpoint, payload,
+                make_completion<beast::error_code, json::value>(std::move(handler), self->strand));
+          }, token, std::move(endpoint), std::move(payload));
+    }
+
+private:
+  void enqueue(Job job);
+  void pump();
+  void arm(clock::time_point when);
+  void start(const std::shared_ptr<Connection>& connection, Job job);
+  std::shared_ptr<Connection> acquire();
+};
+
+} // namespace discord
+
+} // namespace dc
@@ -1,49 +1,68 @@
 #include "session.hpp"
 
+#include "../log.hpp"
+
 namespace dc {
 
 namespace discord {
 
-OpCode tag_invoke(json::value_to_tag<OpCode>, const json::value& jv) {
-  return static_cast<OpCode>(json::value_to<int>(jv));
-}
-
-void Session::run(const Gateway& gateway, callback handler) {
+void Session::run(const Gateway& gateway, callback handler, filter wants, failure_callback failed) {
   this->handler = handler;
+  this->wants = wants;
+  this->failed = failed;
 
   connect(gateway);
 }
 
 void Session::connect(const Gateway& gateway) {
   host = gateway.url.substr(gateway.url.find_last_of('/') + 1);
-  std::cout << "[Discord] Connecting to: " << host << '\n';
+  log::info(log::subsystem::discord, "Connecting to: ", host);
 
   resolver.async_resolve(host, "443",
       beast::bind_front_handler(&Session::onResolve, shared_from_this()));
 }
 
 void Session::send(const json::object& data) {
-  bool write_in_progress = !writeQueue.empty();
-  writeQueue.push_back(json::serialize(data));
-
-  if (!write_in_progress)
-    doWrite();
+  asio::dispatch(ws.get_executor(),
+      [self = shared_from_this(), payload = json::serialize(data)]() mutable {
+        bool write_in_progress = !self->writeQueue.empty();
+        self->writeQueue.push_back(std::move(payload));
+        self->reportQueue();
+
+        if (!write_in_progress)
+          self->doWrite();
+      });
 }
 
 void Session::disconnect(close_callback handler) {
-  std::cout << "[Discord] Disconnecting\n";
+  log::info(log::subsystem::discord, "Disconnecting");
 
   closeHandler = std::make_optional(handler);
 
+  // Whatever fails from here on is part of closing
+  failed = nullptr;
+
+  // Never got as far as the websocket handshake; there is nothing to close
+  if (!ws.is_open()) {
+    asio::post(ws.get_executor(),
+        beast::bind_front_handler(&Session::onClose, shared_from_this(), beast::error_code{}));
+    return;
+  }
+
   ws.async_close(ws::close_code::normal,
       beast::bind_front_handler(&Session::onClose, shared_from_this()));
 }
 
+void Session::fail() {
+  if (auto notify = std::exchange(failed, nullptr))
+    notify();
+}
+
 
 void Session::onResolve(beast::error_code ec, tcp::resolver::results_type results) {
   if (ec) {
-    std::cerr << "[Discord] Resolve failed: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "Resolve failed: ", ec.message());
+    return fail();
   }
 
   beast::get_lowest_layer(ws).expires_after(std::chrono::seconds(30));
@@ -54,8 +73,8 @@ void Session::onResolve(beast::error_code ec, tcp::resolver::results_type result
 
 void Session::onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type endpoint) {
   if (ec) {
-    std::cerr << "[Discord] Connect failed: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "Connect failed: ", ec.message());
+    return fail();
   }
 
   host += ':' + std::to_string(endpoint.port());
@@ -64,8 +83,8 @@ void Session::onConnect(beast::error_code ec, tcp::resolver::results_type::endpo
 
   if (!SSL_set_tlsext_host_name(ws.next_layer().native_handle(), host.c_str())) {
     ec = beast::error_code(static_cast<int>(::ERR_get_error()), asio::error::get_ssl_category());
-    std::cerr << "[Discord] SSL Error: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "SSL Error: ", ec.message());
+    return fail();
   }
 
   ws.next_layer().async_handshake(ssl::stream_base::client,
@@ -74,8 +93,8 @@ void Session::onConnect(beast::error_code ec, tcp::resolver::results_type::endpo
 
 void Session::onSslHandshake(beast::error_code ec) {
   if (ec) {
-    std::cerr << "[Discord] SSL Handshake failed: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "SSL Handshake failed: ", ec.message());
+    return fail();
   }
 
   beast::get_lowest_layer(ws).expires_never();
@@ -88,14 +107,16 @@ void Session::onSslHandshake(beast::error_code ec) {
         }
   ));
 
-  ws.async_handshake(host, "/?v=6&encoding=json",
+  auto target = inflater ? "/?v=6&encoding=json&compress=zlib-stream" : "/?v=6&encoding=json";
+
+  ws.async_handshake(host, target,
       beast::bind_front_handler(&Session::onHandshake, shared_from_this()));
 }
 
 void Session::onHandshake(beast::error_code ec) {
   if (ec) {
-    std::cerr << "[Discord] Handshake failed: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "Handshake failed: ", ec.message());
+    return fail();
   }
 
   ws.async_read(buffer,
@@ -106,15 +127,84 @@ void Session::onRead(beast::error_code ec, std::size_t bytes_transferred) {
   boost::ignore_unused(bytes_transferred);
 
   if (ec) {
-    std::cerr << "[Discord] Read failed: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "Read failed: ", ec.message());
+    return fail();
   }
 
-  auto response = json::parse(beast::buffers_to_string(buffer.data()));
+  auto start = std::chrono::steady_clock::now();
+
+  std::string_view frame{ static_cast<const char*>(buffer.data().data()), buffer.size() };
+  stats.bytesReceived += frame.size();
+  bytesTotal.add(frame.size());
+
+  if (inflater) {
+    std::optional<std::string_view> payload;
+    try {
+      payload = inflater->feed(frame);
+    } catch (const std::runtime_error& e) {
+      // The zlib context is shared by the whole connection, so nothing
+      // after this frame can be inflated either
+      log::error(log::subsystem::discord, e.what());
+      return fail();
+    }
+
+    buffer.clear();
+
+    if (!payload) {
+      ws.async_read(buffer,
+          beast::bind_front_handler(&Session::onRead, shared_from_this()));
+      return;
+    }
+
+    frame = *payload;
+  }
+
+  Frame envelope;
+  if (!scan(frame, envelope)) {
+    log::warn(log::subsystem::discord, "Malformed frame: ", frame.substr(0, 128));
+  } else if (envelope.raw.empty()
+      || (envelope.op == OpCode::Dispatch && wants && !wants(envelope.event))) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    stats.frames++;
+    if (!envelope.raw.empty()) {
+      stats.skipped++;
+      stats.bytesSkipped += envelope.raw.size();
+      skippedTotal.add();
+    }
+    stats.bytesDecoded += frame.size() - envelope.raw.size();
+    stats.decodeTime += elapsed;
+    framesTotal.add();
+    decodeTime.record(elapsed);
+
+    handler(envelope);
+  } else {
+    beast::error_code parseError;
+    parser.reset(&arena);
+    parser.write(envelope.raw, parseError);
+
+    if (parseError) {
+      log::error(log::subsystem::discord, "Failed to parse frame: ", parseError.message());
+    } else {
+      auto data = parser.release();
+      envelope.data = &data;
+
+      auto elapsed = std::chrono::steady_clock::now() - start;
+
+      stats.frames++;
+      stats.bytesDecoded += frame.size();
+      stats.decodeTime += elapsed;
+      framesTotal.add();
+      decodeTime.record(elapsed);
+
+      handler(envelope);
+    }
+  }
+
+  parser.reset();
+  arena.release();
   buffer.clear();
 
-  handler(response);
-  
   ws.async_read(buffer,
       beast::bind_front_handler(&Session::onRead, shared_from_this()));
 }
@@ -126,27 +216,41 @@ void Session::doWrite() {
 
 void Session::onWrite(beast::error_code ec, std::size_t bytes_transferred) {
   if (ec) {
-    std::cerr << "[Discord] Write failed: " << ec.message() << '\n';
-    return;
+    log::error(log::subsystem::discord, "Write failed: ", ec.message());
+    return fail();
   }
 
   writeQueue.pop_front();
+  reportQueue();
 
   if (!writeQueue.empty())
     doWrite();
 }
 
+void Session::reportQueue() {
+  auto size = writeQueue.size();
+  queuedFrames.add(static_cast<std::int64_t>(size) - static_cast<std::int64_t>(queuedReported));
+  queuedReported = size;
+}
+
 void Session::onClose(beast::error_code ec) {
+  log::info(log::subsystem::discord, "Session closed [frames: ", stats.frames,
+      ", received: ", stats.bytesReceived,
+      ", decoded: ", stats.bytesDecoded,
+      ", decode time: ", std::chrono::duration_cast<std::chrono::microseconds>(stats.decodeTime).count(),
+      "us, skipped: ", stats.skipped,
+      ", unparsed: ", stats.bytesSkipped, "]");
+
   if (ec == ssl::error::stream_truncated) {
     ec = {};
   }
 
   if (ec) {
-    std::cerr << "[Discord] Close failed: " << ec.message() << '\n';
+    log::error(log::subsystem::discord, "Close failed: ", ec.message());
   }
 
   if (closeHandler)
-    closeHandler.value();
+    (*closeHandler)();
 }
 
 } // namespace discord
@@ -1,28 +1,15 @@
 #pragma once
 
 #include "../common.hpp"
+#include "../metrics.hpp"
+#include "frame.hpp"
 #include "gateway.hpp"
+#include "inflater.hpp"
 
 namespace dc {
 
 namespace discord {
 
-enum class OpCode {
-  Dispatch            = 0,
-  Heartbeat           = 1,
-  Identify            = 2,
-  PresenceUpdate      = 3,
-  VoiceStateUpdate    = 4,
-  Resume              = 6,
-  Reconnect           = 7,
-  RequestGuildMembers = 8,
-  InvalidSession      = 9,
-  Hello               = 10,
-  HeartbeatAck        = 11,
-};
-
-OpCode tag_invoke(json::value_to_tag<OpCode>, const json::value& jv);
-
 const int GUILDS                    = 1 << 0;
 const int GUILD_MEMBERS             = 1 << 1;
 const int GUILD_BANS                = 1 << 2;
@@ -41,8 +28,22 @@ const int DIRECT_MESSAGE_TYPING     = 1 << 14;
 
 class Session : public std::enable_shared_from_this<Session> {
   using Stream = ws::stream<beast::ssl_stream<beast::tcp_stream>>;
-  using callback = std::function<void(const json::value& data)>;
+  using callback = std::function<void(const Frame& frame)>;
+  using filter = std::function<bool(std::string_view event)>;
   using close_callback = std::function<void()>;
+  using failure_callback = std::function<void()>;
+
+public:
+  struct Stats {
+    std::uint64_t frames{ 0 };
+    std::uint64_t bytesReceived{ 0 };
+    std::uint64_t bytesDecoded{ 0 };
+    std::chrono::nanoseconds decodeTime{ 0 };
+    std::uint64_t skipped{ 0 };
+    std::uint64_t bytesSkipped{ 0 };
+  };
+
+private:
 
   tcp::resolver resolver;
   Stream ws;
@@ -50,19 +51,55 @@ class Session : public std::enable_shared_from_this<Session> {
   std::deque<std::string> writeQueue;
   std::string host;
   callback handler;
+  filter wants;
   std::optional<close_callback> closeHandler;
+  failure_callback failed;
+  std::optional<Inflater> inflater;
+  Stats stats;
+
+  metrics::counter& framesTotal;
+  metrics::counter& bytesTotal;
+  metrics::counter& skippedTotal;
+  metrics::histogram& decodeTime;
+  // Shared by every session; this one's share is tracked in queuedReported
+  metrics::gauge& queuedFrames;
+  std::size_t queuedReported{ 0 };
+
+  // Each frame's DOM is built in the arena and dropped once the handler
+  // returns, so handlers must copy anything they keep.
+  unsigned char arenaBuffer[64 * 1024];
+  json::monotonic_resource arena;
+  json::parser parser;
 
 public:
-  explicit Session(asio::io_context& io, ssl::context& ctx)
-    : resolver(asio::make_strand(io))
-    , ws(asio::make_strand(io), ctx)
-  {}
+  explicit Session(const io_strand& strand, ssl::context& ctx, bool compress = false)
+    : resolver(strand)
+    , ws(strand, ctx)
+    , framesTotal(metrics::global().get_counter("dc_discord_frames_total", "Gateway frames received"))
+    , bytesTotal(metrics::global().get_counter("dc_discord_received_bytes_total", "Bytes received from the gateway"))
+    , skippedTotal(metrics::global().get_counter("dc_discord_skipped_frames_total", "Dispatches passed on without parsing their data"))
+    , decodeTime(metrics::global().get_histogram("dc_discord_decode_nanoseconds", "Time to inflate, scan and parse a frame"))
+    , queuedFrames(metrics::global().get_gauge("dc_discord_write_queue_frames", "Gateway frames waiting to be written"))
+    , arena(arenaBuffer, sizeof(arenaBuffer))
+  {
+    if (compress)
+      inflater.emplace();
+  }
 
-  void run(const Gateway& gateway, callback handler);
+  ~Session() {
+    queuedFrames.add(-static_cast<std::int64_t>(queuedReported));
+  }
+
+  // Dispatch events `wants` rejects reach the handler with `d` unparsed.
+  // `failed` is called once when the stream can't go on and must be
+  // replaced, whether connecting, reading, writing or inflating failed.
+  void run(const Gateway& gateway, callback handler, filter wants = {}, failure_callback failed = {});
   void connect(const Gateway& gateway);
   void send(const json::object& data);
   void disconnect(close_callback handler);
 
+  const Stats& getStats() const { return stats; }
+
 private:
   void onResolve(beast::error_code ec, tcp::resolver::results_type results);
   void onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type endpoint);
@@ -70,7 +107,9 @@ private:
   void onHandshake(beast::error_code ec);
   void onRead(beast::error_code ec, std::size_t bytes);
   void doWrite();
+  void reportQueue();
   void onWrite(beast::error_code ec, std::size_t bytes);
+  void fail();
   void onClose(beast::error_code ec);
 
 };
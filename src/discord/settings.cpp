@@ -0,0 +1,21 @@
+#include "settings.hpp"
+
+namespace dc {
+
+namespace discord {
+
+constexpr auto settingsFields = std::make_tuple(
+    required("enabled", &Settings::enabled),
+    required("token", &Settings::token),
+    optional("compress", &Settings::compress),
+    optional("shards", &Settings::shards),
+    optional("members", &Settings::members),
+    optional("cache_size", &Settings::cacheSize));
+
+std::error_code decode(const json::value& jv, Settings& s) {
+  return decode_object(jv, s, settingsFields);
+}
+
+} // namespace discord
+
+} // namespace dc
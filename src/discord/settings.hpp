@@ -0,0 +1,22 @@
+#pragma once
+
+#include "../common.hpp"
+
+namespace dc {
+
+namespace discord {
+
+struct Settings {
+  bool enabled;
+  std::string token;
+  bool compress{ true };
+  int shards{ 0 };
+  bool members{ false };
+  int cacheSize{ 64 };
+};
+
+std::error_code decode(const json::value& jv, Settings& s);
+
+} // namespace discord
+
+} // namespace dc
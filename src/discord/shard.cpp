@@ -0,0 +1,297 @@
+#include "shard.hpp"
+
+#include "../log.hpp"
+#include "bot.hpp"
+#include "event.hpp"
+
+namespace dc {
+
+namespace discord {
+
+void Shard::run() {
+  session = std::make_shared<Session>(strand, ctx, settings.compress);
+  session->run(gateway,
+      [this](const Frame& frame) {
+        onSessionData(frame);
+      },
+      [this](std::string_view event) {
+        return wants(event);
+      },
+      [this] {
+        log::warn(log::subsystem::discord, "[Shard ", id, "] Session failed, reconnecting");
+        reconnect();
+      });
+}
+
+void Shard::reconnect() {
+  asio::dispatch(strand,
+      [this] {
+        cancelHeartbeat();
+
+        session->disconnect([this] { onDisconnect(); });
+      });
+}
+
+void Shard::identify() {
+  asio::dispatch(strand, [this] { sendIdentify(); });
+}
+
+void Shard::onSessionData(const Frame& frame) {
+  switch (frame.op) {
+    case OpCode::Dispatch: {
+      if (frame.sequence)
+        sequence = *frame.sequence;
+
+      onDispatch(frame.event, frame.data);
+    } break;
+    case OpCode::Heartbeat: {
+    } break;
+    case OpCode::Reconnect: {
+      log::info(log::subsystem::discord, "[Shard ", id, "] Reconnect");
+      reconnect();
+    } break;
+    case OpCode::InvalidSession: {
+      log::info(log::subsystem::discord, "[Shard ", id, "] Invalid Session received: ", frame.raw);
+      onInvalidSession();
+    } break;
+    case OpCode::Hello: {
+      if (frame.data)
+        onHello(json::value_to<int>(frame.data->at("heartbeat_interval")));
+    } break;
+    case OpCode::HeartbeatAck: {
+      needAck--;
+      if (needAck < 0) {
+        log::warn(log::subsystem::discord, "[Shard ", id, "] Received extra Heartbeat Ack");
+      } else {
+        heartbeatRtt.record(std::chrono::steady_clock::now() - heartbeatSent);
+      }
+    } break;
+    default: {
+      log::warn(log::subsystem::discord, "[Shard ", id, "] Unexpected opcode: ", static_cast<int>(frame.op),
+          ", payload: ", frame.raw);
+    } break;
+  }
+}
+
+bool Shard::wants(std::string_view event) const {
+  switch (static_cast<Event>(fnv1a_32(event))) {
+    case Event::Ready:
+    case Event::Resumed:
+      return true;
+    default:
+      return bot.wants(event);
+  }
+}
+
+void Shard::onDispatch(std::string_view event, const json::value* data) {
+  if (!data)
+    return;
+
+  switch (static_cast<Event>(fnv1a_32(event))) {
+    case Event::Ready: {
+      identified = true;
+      session_id = json::value_to<std::string>(data->at("session_id"));
+    } break;
+    case Event::Resumed: {
+      log::info(log::subsystem::discord, "[Shard ", id, "] Resumed");
+      sendMemberRequest();
+    } break;
+    case Event::GuildCreate: {
+      requestMembers(*data);
+    } break;
+    case Event::GuildMembersChunk: {
+      onMembersChunk(*data);
+    } break;
+    default:
+      break;
+  }
+
+  bot.onDispatch(*this, event, *data);
+}
+
+void Shard::onInvalidSession() {
+  session_id.clear();
+  identified = false;
+
+  // A fresh session replays every GUILD_CREATE, which queues them again
+  memberRequests.clear();
+  requestingMembers.reset();
+
+  reconnect();
+}
+
+void Shard::onDisconnect() {
+  log::debug(log::subsystem::discord, "[Shard ", id, "] onDisconnect");
+
+  needAck = 0;
+
+  if (requestingMembers) {
+    memberRequests.push_front(*requestingMembers);
+    requestingMembers.reset();
+  }
+
+  // The first retry is immediate, then 1s doubling up to a minute
+  if (failures++ == 0) {
+    run();
+    return;
+  }
+
+  auto delay = std::min(std::chrono::seconds(1) * (1 << std::min(failures - 2, 6)),
+      std::chrono::seconds(60));
+  log::info(log::subsystem::discord, "[Shard ", id, "] Reconnecting in ", delay.count(), "s");
+
+  timers.schedule(delay,
+      [this] {
+        asio::dispatch(strand, [this] { run(); });
+      });
+}
+
+void Shard::onHello(int heartbeatInterval) {
+  log::debug(log::subsystem::discord, "[Shard ", id, "] Hello");
+
+  heartrate = std::chrono::milliseconds(heartbeatInterval);
+  failures = 0;
+
+  sendHeartbeat();
+
+  if (!identified) {
+    bot.requestIdentify(*this);
+  } else {
+    sendResume();
+  }
+}
+
+void Shard::scheduleHeartbeat() {
+  cancelHeartbeat();
+
+  auto beat = heartbeatEpoch;
+  heartbeat = timers.schedule(heartrate,
+      [this, beat] {
+        asio::dispatch(strand,
+            [this, beat] {
+              if (beat == heartbeatEpoch)
+                sendHeartbeat();
+            });
+      });
+}
+
+void Shard::cancelHeartbeat() {
+  ++heartbeatEpoch;
+
+  if (heartbeat) {
+    timers.cancel(*heartbeat);
+    heartbeat.reset();
+  }
+}
+
+void Shard::sendHeartbeat() {
+  if (needAck > 0) {
+    log::warn(log::subsystem::discord, "[Shard ", id, "] Unacked heartbeat, reconnecting");
+    reconnect();
+    return;
+  }
+
+  scheduleHeartbeat();
+
+  needAck++;
+  heartbeatSent = std::chrono::steady_clock::now();
+
+  if (sequence >= 0) {
+    send(OpCode::Heartbeat, sequence);
+  } else {
+    send(OpCode::Heartbeat, nullptr);
+  }
+}
+
+void Shard::requestMembers(const json::value& guild) {
+  if (!settings.members)
+    return;
+
+  const auto& object = guild.as_object();
+  if (object.count("unavailable") && object.at("unavailable").as_bool())
+    return;
+
+  memberRequests.push_back(json::value_to<std::string>(object.at("id")));
+  sendMemberRequest();
+}
+
+void Shard::onMembersChunk(const json::value& chunk) {
+  const auto& object = chunk.as_object();
+  auto index = json::value_to<int>(object.at("chunk_index"));
+  auto count = json::value_to<int>(object.at("chunk_count"));
+
+  if (index + 1 < count)
+    return;
+
+  requestingMembers.reset();
+  sendMemberRequest();
+}
+
+void Shard::sendMemberRequest() {
+  if (requestingMembers || memberRequests.empty() || !identified)
+    return;
+
+  requestingMembers = memberRequests.front();
+  memberRequests.pop_front();
+
+  json::object data{
+    { "guild_id", *requestingMembers },
+    { "query", "" },
+    { "limit", 0 }
+  };
+
+  send(OpCode::RequestGuildMembers, data);
+}
+
+void Shard::sendIdentify() {
+  int intents = GUILDS | GUILD_MESSAGES | DIRECT_MESSAGES;
+  if (settings.members)
+    intents |= GUILD_MEMBERS;
+
+  json::object data{
+    { "token", settings.token },
+    { "intents", intents },
+    { "properties", {
+      { "$os", "linux" },
+      { "$browser", "DigitalColleague" },
+      { "$device", "DigitalColleague" }
+    }},
+    { "compress", false },
+    { "shard", json::array{ id, count } },
+    { "presence", {
+      { "activities", nullptr },
+      { "status", "online" },
+      { "since", nullptr },
+      { "afk", false }
+    }}
+  };
+
+  log::info(log::subsystem::discord, "[Shard ", id, "] Identifying");
+
+  send(OpCode::Identify, data);
+}
+
+void Shard::sendResume() {
+  json::object data{
+    { "token", settings.token },
+    { "session_id", session_id },
+    { "seq", sequence }
+  };
+
+  log::info(log::subsystem::discord, "[Shard ", id, "] Resuming");
+
+  send(OpCode::Resume, data);
+}
+
+void Shard::send(OpCode op, const json::value& data) {
+  json::object payload{
+    { "op", static_cast<int>(op) },
+    { "d", data }
+  };
+
+  session->send(payload);
+}
+
+} // namespace discord
+
+} // namespace dc
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <deque>
+
+#include "../metrics.hpp"
+#include "../timer_wheel.hpp"
+#include "session.hpp"
+#include "settings.hpp"
+
+namespace dc {
+
+namespace discord {
+
+class Bot;
+
+/*
+ * One gateway connection. Each shard keeps its own heartbeat, sequence and
+ * session for resuming, and runs on its own strand so shards spread over
+ * the io threads.
+ */
+class Shard {
+  asio::io_context& io;
+  ssl::context& ctx;
+  io_strand strand;
+  Bot& bot;
+  const Settings& settings;
+  Gateway gateway;
+  int id;
+  int count;
+
+  std::shared_ptr<Session> session;
+  std::string session_id;
+  bool identified{ false };
+  // Connections lost since the last Hello; the next one waits longer
+  int failures{ 0 };
+
+  timer_service& timers;
+  std::optional<timer_id> heartbeat;
+  // Bumped on every reschedule, so a beat already in flight can tell it is stale
+  std::uint64_t heartbeatEpoch{ 0 };
+  std::chrono::milliseconds heartrate;
+  int needAck{ 0 };
+  int sequence{ -1 };
+  std::chrono::steady_clock::time_point heartbeatSent;
+  metrics::histogram& heartbeatRtt;
+
+  // Member lists are requested one guild at a time, chunks streaming in
+  std::deque<std::string> memberRequests;
+  std::optional<std::string> requestingMembers;
+
+public:
+  Shard(asio::io_context& io, ssl::context& ctx, timer_service& timers, Bot& bot,
+      const Settings& settings, const Gateway& gateway, int id, int count)
+    : io(io)
+    , ctx(ctx)
+    , strand(io.get_executor())
+    , bot(bot)
+    , settings(settings)
+    , gateway(gateway)
+    , id(id)
+    , count(count)
+    , timers(timers)
+    , heartbeatRtt(metrics::global().get_histogram("dc_discord_heartbeat_rtt_nanoseconds",
+          "Time from heartbeat to acknowledgement", "shard=\"" + std::to_string(id) + '"'))
+  {}
+
+  ~Shard() { cancelHeartbeat(); }
+
+  void run();
+  void reconnect();
+  void identify();
+
+  int getId() const { return id; }
+
+private:
+  void onSessionData(const Frame& frame);
+  bool wants(std::string_view event) const;
+  void onDisconnect();
+
+  void onDispatch(std::string_view event, const json::value* data);
+  void onInvalidSession();
+  void onHello(int heartbeatInterval);
+
+  void scheduleHeartbeat();
+  void cancelHeartbeat();
+  void sendHeartbeat();
+  void requestMembers(const json::value& guild);
+  void onMembersChunk(const json::value& chunk);
+  void sendMemberRequest();
+
+  void sendIdentify();
+  void sendResume();
+  void send(OpCode op, const json::value& data);
+};
+
+} // namespace discord
+
+} // namespace dc
@@ -1,12 +1,31 @@
 #include "snowflake.hpp"
 
+#include <charconv>
+
 namespace dc {
 
 namespace discord {
 
-Snowflake tag_invoke(json::value_to_tag<Snowflake>, const json::value& jv) {
-  auto s = json::value_to<std::string>(jv);
-  return { std::stoull(s) };
+std::error_code decode(const json::value& jv, Snowflake& s) {
+  if (auto number = jv.if_uint64()) {
+    s.id = *number;
+    return {};
+  }
+
+  auto string = jv.if_string();
+  if (!string)
+    return make_error_code(decode_error::wrong_type);
+
+  auto first = string->data();
+  auto last = first + string->size();
+  auto [end, ec] = std::from_chars(first, last, s.id);
+
+  if (ec == std::errc::result_out_of_range)
+    return make_error_code(decode_error::out_of_range);
+  if (ec != std::errc{} || end != last)
+    return make_error_code(decode_error::wrong_type);
+
+  return {};
 }
 
 } // namespace discord
@@ -29,7 +29,8 @@ struct Snowflake {
 
 };
 
-Snowflake tag_invoke(json::value_to_tag<Snowflake>, const json::value& jv);
+// Snowflakes are sent as strings, so they survive JavaScript number precision
+std::error_code decode(const json::value& jv, Snowflake& s);
 
 } // namespace discord
 
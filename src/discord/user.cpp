@@ -4,15 +4,15 @@ namespace dc {
 
 namespace discord {
 
-User tag_invoke(json::value_to_tag<User>, const json::value& jv) {
-  User u;
-  auto object = jv.as_object();
-  extract(object, u.id, "id");
-  extract(object, u.username, "username");
-  extract(object, u.discriminator, "discriminator");
-  extract_optional(object, u.avatar, "avatar");
-  extract_maybe(object, u.bot, "bot", false);
-  return u;
+constexpr auto userFields = std::make_tuple(
+    required("id", &User::id),
+    required("username", &User::username),
+    required("discriminator", &User::discriminator),
+    required("avatar", &User::avatar),
+    optional("bot", &User::bot));
+
+std::error_code decode(const json::value& jv, User& u) {
+  return decode_object(jv, u, userFields);
 }
 
 } // namespace discord
@@ -12,10 +12,10 @@ struct User {
   std::string username;
   std::string discriminator;
   std::optional<std::string> avatar;
-  bool bot;
+  bool bot{ false };
 };
 
-User tag_invoke(json::value_to_tag<User>, const json::value& jv);
+std::error_code decode(const json::value& jv, User& u);
 
 } // namespace discord
 
@@ -0,0 +1,144 @@
+#include "event_bus.hpp"
+
+#include "log.hpp"
+
+namespace dc {
+
+constexpr auto event_bus_fields = std::make_tuple(
+    optional("workers", &event_bus_settings::workers),
+    optional("queue_size", &event_bus_settings::queue_size));
+
+std::error_code decode(const json::value& jv, event_bus_settings& s) {
+  return decode_object(jv, s, event_bus_fields);
+}
+
+event_bus::event_bus(const event_bus_settings& settings)
+  : settings_(settings)
+  , published(metrics::global().get_counter("dc_events_total", "Chat events published"))
+  , waited(metrics::global().get_counter("dc_events_full_total", "Publishes that waited on a full queue"))
+  , latency(metrics::global().get_histogram("dc_events_latency_nanoseconds", "Time from publish until handled"))
+{
+  auto count = static_cast<std::size_t>(std::max(1, settings_.workers));
+  for (std::size_t i = 0; i < count; ++i)
+    workers.push_back(std::make_unique<worker>(settings_.queue_size));
+}
+
+event_bus::~event_bus() {
+  stop();
+}
+
+void event_bus::subscribe(handler h) {
+  handlers.push_back(std::move(h));
+}
+
+void event_bus::start() {
+  for (auto& w: workers)
+    w->thread = std::thread{ [this, &w = *w] { run(w); } };
+}
+
+void event_bus::stop() {
+  if (stopping.exchange(true))
+    return;
+
+  for (auto& w: workers) {
+    {
+      std::lock_guard lock{ w->mutex };
+      w->sleeping = false;
+    }
+    w->wake.notify_one();
+    w->room.notify_all();
+  }
+
+  for (auto& w: workers) {
+    if (w->thread.joinable())
+      w->thread.join();
+  }
+}
+
+void event_bus::publish(chat_event event) {
+  auto& w = *workers[std::hash<std::string_view>{}(event.channel) % workers.size()];
+  event.published = std::chrono::steady_clock::now();
+
+  auto fill = [&](chat_event& slot) { slot = std::move(event); };
+
+  if (!w.queue.try_push(fill)) {
+    waited.add();
+
+    std::unique_lock lock{ w.mutex };
+    ++w.blocked;
+    w.room.wait(lock, [&] { return stopping || w.queue.try_push(fill); });
+    --w.blocked;
+
+    if (stopping)
+      return;
+  }
+
+  published.add();
+
+  if (w.sleeping.load(std::memory_order_relaxed) && w.sleeping.exchange(false))
+    w.wake.notify_one();
+}
+
+bool event_bus::congested() const {
+  for (const auto& w: workers) {
+    if (w->queue.size() * 4 > w->queue.capacity() * 3)
+      return true;
+  }
+  return false;
+}
+
+void event_bus::run(worker& w) {
+  chat_event event;
+
+  for (;;) {
+    while (w.queue.try_pop([&](chat_event& slot) { event = std::move(slot); })) {
+      // Pairs with the increment in publish: either it sees the free slot
+      // or we see it waiting. Taking the mutex closes the gap before wait()
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (w.blocked) {
+        { std::lock_guard lock{ w.mutex }; }
+        w.room.notify_all();
+      }
+
+      for (const auto& h: handlers) {
+        try {
+          h(event);
+        } catch (const std::exception& e) {
+          log::error(log::subsystem::core, "Event handler failed: ", e.what());
+        }
+      }
+
+      if (waiting.load(std::memory_order_relaxed))
+        wake_waiters(event);
+
+      latency.record(std::chrono::steady_clock::now() - event.published);
+    }
+
+    std::unique_lock lock{ w.mutex };
+    if (stopping && !w.queue.size())
+      return;
+
+    // See logger::run for why the timeout is there
+    w.sleeping = true;
+    w.wake.wait_for(lock, std::chrono::milliseconds(50),
+        [&] { return !w.sleeping || stopping; });
+    w.sleeping = false;
+  }
+}
+
+void event_bus::wake_waiters(const chat_event& event) {
+  std::lock_guard lock{ waiters_mutex };
+
+  for (auto w = waiters.begin(); w != waiters.end();) {
+    if (!w->first || w->first(event)) {
+      w->second(event);
+      w = waiters.erase(w);
+    } else {
+      ++w;
+    }
+  }
+
+  waiting = waiters.size();
+}
+
+} // namespace dc
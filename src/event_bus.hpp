@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "async.hpp"
+#include "common.hpp"
+#include "metrics.hpp"
+#include "mpsc_ring.hpp"
+
+namespace dc {
+
+struct event_bus_settings {
+  int workers{ 2 };
+  std::size_t queue_size{ 4096 };
+};
+
+std::error_code decode(const json::value& jv, event_bus_settings& s);
+
+enum class platform {
+  twitch,
+  discord,
+};
+
+// A chat message, the same whichever platform it came from
+struct chat_event {
+  chat_event() = default;
+  chat_event(platform source, std::string channel, std::string author, std::string text,
+      std::int64_t timestamp)
+    : source(source)
+    , channel(std::move(channel))
+    , author(std::move(author))
+    , text(std::move(text))
+    , timestamp(timestamp)
+  {}
+
+  platform source{ platform::twitch };
+  std::string channel;
+  std::string author;
+  std::string text;
+  std::int64_t timestamp{ 0 };
+  std::chrono::steady_clock::time_point published;
+};
+
+/*
+ * Hands chat events from the io threads to a pool of worker threads.
+ * Every channel hashes to one worker and each worker has its own
+ * lock-free queue, so a channel's events are handled in order while
+ * channels spread over the workers. When a queue fills up, publish
+ * blocks until the worker makes room; readers that can pause should
+ * check congested() before reading more so it never comes to that.
+ */
+class event_bus {
+public:
+  using handler = std::function<void(const chat_event&)>;
+  using filter = std::function<bool(const chat_event&)>;
+
+private:
+  struct worker {
+    explicit worker(std::size_t capacity) : queue(capacity) {}
+
+    mpsc_ring<chat_event> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> sleeping{ false };
+    // Publishers waiting on a full queue
+    std::condition_variable room;
+    std::atomic<int> blocked{ 0 };
+    std::thread thread;
+  };
+
+  event_bus_settings settings_;
+  std::vector<std::unique_ptr<worker>> workers;
+  std::vector<handler> handlers;
+  std::atomic<bool> stopping{ false };
+
+  // One-shot, from async_next; the count spares the lock when nobody waits
+  std::mutex waiters_mutex;
+  std::vector<std::pair<filter, std::function<void(chat_event)>>> waiters;
+  std::atomic<std::size_t> waiting{ 0 };
+
+  metrics::counter& published;
+  metrics::counter& waited;
+  metrics::histogram& latency;
+
+public:
+  explicit event_bus(const event_bus_settings& settings);
+  ~event_bus();
+
+  event_bus(const event_bus&) = delete;
+  event_bus& operator=(const event_bus&) = delete;
+
+  // Subscribers must be added before start()
+  void subscribe(handler h);
+  void start();
+  // Handles whatever is still queued, then joins the workers
+  void stop();
+
+  void publish(chat_event event);
+
+  // Completes with the next event passing `f`, on the waiter's executor
+  template <class CompletionToken>
+    auto async_next(filter f, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(chat_event)>(
+          [this](auto handler, filter f) {
+            std::lock_guard lock{ waiters_mutex };
+            waiters.emplace_back(std::move(f),
+                make_completion<chat_event>(std::move(handler), asio::system_executor{}));
+            waiting = waiters.size();
+          }, token, std::move(f));
+    }
+
+  // True while any queue is more than three quarters full
+  bool congested() const;
+
+private:
+  void run(worker& w);
+  void wake_waiters(const chat_event& event);
+};
+
+} // namespace dc
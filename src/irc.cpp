@@ -0,0 +1,128 @@
+#include "irc.hpp"
+
+namespace dc {
+
+namespace irc {
+
+namespace {
+
+std::string_view next_token(std::string_view& rest) {
+  auto end = rest.find(' ');
+  auto token = rest.substr(0, end);
+  rest.remove_prefix(end == std::string_view::npos ? rest.size() : end);
+  return token;
+}
+
+void skip_spaces(std::string_view& rest) {
+  auto start = rest.find_first_not_of(' ');
+  rest.remove_prefix(start == std::string_view::npos ? rest.size() : start);
+}
+
+} // namespace
+
+std::string_view message::nick() const {
+  return prefix.substr(0, prefix.find_first_of("!@"));
+}
+
+std::optional<std::string_view> message::raw_tag(std::string_view key) const {
+  std::string_view rest = tags;
+
+  while (!rest.empty()) {
+    auto end = rest.find(';');
+    auto tag = rest.substr(0, end);
+    rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+
+    auto equals = tag.find('=');
+    if (tag.substr(0, equals) != key)
+      continue;
+
+    if (equals == std::string_view::npos)
+      return std::string_view{};
+
+    return tag.substr(equals + 1);
+  }
+
+  return std::nullopt;
+}
+
+std::optional<std::string> message::tag(std::string_view key) const {
+  auto value = raw_tag(key);
+  if (!value)
+    return std::nullopt;
+
+  return unescape_tag(*value);
+}
+
+bool parse(std::string_view line, message& msg) {
+  while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+    line.remove_suffix(1);
+
+  msg = message{};
+  msg.raw = line;
+
+  std::string_view rest = line;
+
+  if (!rest.empty() && rest.front() == '@') {
+    rest.remove_prefix(1);
+    msg.tags = next_token(rest);
+    skip_spaces(rest);
+  }
+
+  if (!rest.empty() && rest.front() == ':') {
+    rest.remove_prefix(1);
+    msg.prefix = next_token(rest);
+    skip_spaces(rest);
+  }
+
+  msg.command = next_token(rest);
+  if (msg.command.empty())
+    return false;
+
+  for (;;) {
+    skip_spaces(rest);
+    if (rest.empty())
+      break;
+
+    if (rest.front() == ':' || msg.param_count == message::max_params - 1) {
+      if (rest.front() == ':')
+        rest.remove_prefix(1);
+
+      msg.params[msg.param_count++] = rest;
+      msg.has_trailing = true;
+      break;
+    }
+
+    msg.params[msg.param_count++] = next_token(rest);
+  }
+
+  return true;
+}
+
+std::string unescape_tag(std::string_view value) {
+  std::string result;
+  result.reserve(value.size());
+
+  for (std::size_t i = 0; i < value.size(); ++i) {
+    if (value[i] != '\\') {
+      result += value[i];
+      continue;
+    }
+
+    if (++i == value.size())
+      break;
+
+    switch (value[i]) {
+      case ':': result += ';'; break;
+      case 's': result += ' '; break;
+      case 'r': result += '\r'; break;
+      case 'n': result += '\n'; break;
+      default: result += value[i]; break;
+    }
+  }
+
+  return result;
+}
+
+} // namespace irc
+
+} // namespace dc
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+
+#include "common.hpp"
+
+namespace dc {
+
+namespace irc {
+
+/*
+ * A parsed IRCv3 line. All views point into the line that was parsed and
+ * are only valid for as long as that buffer is.
+ *
+ * https://ircv3.net/specs/extensions/message-tags
+ */
+struct message {
+  static constexpr std::size_t max_params = 15;
+
+  std::string_view raw;
+  std::string_view tags;
+  std::string_view prefix;
+  std::string_view command;
+  std::array<std::string_view, max_params> params;
+  std::size_t param_count{ 0 };
+  bool has_trailing{ false };
+
+  std::string_view param(std::size_t index) const {
+    return index < param_count ? params[index] : std::string_view{};
+  }
+
+  std::string_view trailing() const {
+    return has_trailing ? params[param_count - 1] : std::string_view{};
+  }
+
+  std::string_view nick() const;
+
+  std::optional<std::string_view> raw_tag(std::string_view key) const;
+  std::optional<std::string> tag(std::string_view key) const;
+};
+
+bool parse(std::string_view line, message& msg);
+
+/*
+ * A message holding its own copy of the line, for keeping past the read
+ * buffer. The copy lives on the heap, so moves keep the views valid.
+ */
+class owned_message {
+  std::shared_ptr<const std::string> line;
+  message msg;
+
+public:
+  owned_message() = default;
+  explicit owned_message(const message& m)
+    : line(std::make_shared<const std::string>(m.raw))
+  {
+    parse(*line, msg);
+  }
+
+  const message& get() const { return msg; }
+  const message* operator->() const { return &msg; }
+};
+
+std::string unescape_tag(std::string_view value);
+
+} // namespace irc
+
+} // namespace dc
@@ -0,0 +1,48 @@
+#include "line_buffer.hpp"
+
+#include <cstring>
+
+namespace dc {
+
+asio::mutable_buffer line_buffer::prepare(std::size_t min_free) {
+  if (storage.size() - tail < min_free && head > 0) {
+    std::memmove(storage.data(), storage.data() + head, tail - head);
+    scanned -= head;
+    tail -= head;
+    head = 0;
+  }
+
+  if (storage.size() - tail < min_free) {
+    auto size = std::max(storage.size() * 2, tail + min_free);
+    if (size > max_size)
+      throw std::length_error("line_buffer: line exceeds maximum size");
+    storage.resize(size);
+  }
+
+  return asio::buffer(storage.data() + tail, storage.size() - tail);
+}
+
+std::optional<std::string_view> line_buffer::next_line() {
+  // memchr is vectorized by the C library, which makes it the fastest
+  // portable way to find the terminator in a large burst.
+  auto* start = storage.data() + scanned;
+  auto* found = static_cast<const char*>(std::memchr(start, '\n', tail - scanned));
+
+  if (!found) {
+    scanned = tail;
+    if (head == tail)
+      head = scanned = tail = 0;
+    return std::nullopt;
+  }
+
+  auto end = static_cast<std::size_t>(found - storage.data());
+  std::string_view line{ storage.data() + head, end - head };
+  if (!line.empty() && line.back() == '\r')
+    line.remove_suffix(1);
+
+  head = scanned = end + 1;
+
+  return line;
+}
+
+} // namespace dc
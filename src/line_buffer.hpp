@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "common.hpp"
+
+namespace dc {
+
+/*
+ * Receive buffer that frames CRLF (or bare LF) terminated lines without
+ * copying them. Lines handed out by next_line() point into the buffer and
+ * stay valid until the next call to prepare().
+ */
+class line_buffer {
+  std::vector<char> storage;
+  std::size_t head{ 0 };
+  std::size_t scanned{ 0 };
+  std::size_t tail{ 0 };
+  std::size_t max_size;
+
+public:
+  explicit line_buffer(std::size_t capacity = 16 * 1024, std::size_t max_size = 1024 * 1024)
+    : storage(capacity)
+    , max_size(max_size)
+  {}
+
+  asio::mutable_buffer prepare(std::size_t min_free = 4096);
+  void commit(std::size_t bytes) { tail += bytes; }
+
+  std::optional<std::string_view> next_line();
+
+  std::size_t size() const { return tail - head; }
+  void clear() { head = scanned = tail = 0; }
+};
+
+} // namespace dc
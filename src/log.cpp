@@ -0,0 +1,190 @@
+#include "log.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+namespace dc {
+
+namespace log {
+
+namespace {
+
+  constexpr std::array<std::string_view, 6> level_names{
+    "trace", "debug", "info", "warn", "error", "off"
+  };
+
+  constexpr std::array<std::string_view, subsystem_count> subsystem_names{
+    "core", "twitch", "discord", "console", "database", "archive", "metrics"
+  };
+
+  constexpr std::array<std::string_view, subsystem_count> subsystem_tags{
+    "", "[Twitch] ", "[Discord] ", "[Console] ", "[Database] ", "[Archive] ", "[Metrics] "
+  };
+
+} // namespace
+
+std::string_view to_string(level l) {
+  return level_names[static_cast<std::size_t>(l)];
+}
+
+std::string_view to_string(subsystem s) {
+  return subsystem_names[static_cast<std::size_t>(s)];
+}
+
+std::optional<level> parse_level(std::string_view name) {
+  for (std::size_t i = 0; i < level_names.size(); ++i) {
+    if (level_names[i] == name)
+      return static_cast<level>(i);
+  }
+  return std::nullopt;
+}
+
+std::optional<subsystem> parse_subsystem(std::string_view name) {
+  for (std::size_t i = 0; i < subsystem_names.size(); ++i) {
+    if (subsystem_names[i] == name)
+      return static_cast<subsystem>(i);
+  }
+  return std::nullopt;
+}
+
+std::error_code decode(const json::value& jv, level& l) {
+  auto name = jv.if_string();
+  if (!name)
+    return make_error_code(decode_error::wrong_type);
+
+  auto parsed = parse_level(*name);
+  if (!parsed)
+    return make_error_code(decode_error::out_of_range);
+
+  l = *parsed;
+  return {};
+}
+
+constexpr auto settings_fields = std::make_tuple(
+    optional("level", &settings::default_level),
+    optional("aegis", &settings::aegis),
+    optional("core", &settings::core),
+    optional("twitch", &settings::twitch),
+    optional("discord", &settings::discord),
+    optional("console", &settings::console),
+    optional("database", &settings::database),
+    optional("archive", &settings::archive),
+    optional("metrics", &settings::metrics));
+
+std::error_code decode(const json::value& jv, settings& s) {
+  return decode_object(jv, s, settings_fields);
+}
+
+logger::logger(std::size_t capacity)
+  : ring(capacity)
+  , dropped_total(metrics::global().get_counter("dc_log_dropped_total", "Log lines dropped on a full ring"))
+{
+  for (auto& l: levels)
+    l.store(level::info, std::memory_order_relaxed);
+
+  writer = std::thread{ [this] { run(); } };
+}
+
+logger::~logger() {
+  stop();
+}
+
+void logger::configure(const settings& s) {
+  const std::array<std::optional<level>, subsystem_count> overrides{
+    s.core, s.twitch, s.discord, s.console, s.database, s.archive, s.metrics
+  };
+
+  for (std::size_t i = 0; i < subsystem_count; ++i)
+    levels[i].store(overrides[i].value_or(s.default_level), std::memory_order_relaxed);
+}
+
+void logger::set_level(level severity) {
+  for (auto& l: levels)
+    l.store(severity, std::memory_order_relaxed);
+}
+
+void logger::set_level(subsystem source, level severity) {
+  levels[static_cast<std::size_t>(source)].store(severity, std::memory_order_relaxed);
+}
+
+level logger::get_level(subsystem source) const {
+  return levels[static_cast<std::size_t>(source)].load(std::memory_order_relaxed);
+}
+
+void logger::stop() {
+  if (stopping.exchange(true))
+    return;
+
+  {
+    std::lock_guard lock{ mutex };
+    sleeping = false;
+  }
+  wake.notify_one();
+
+  if (writer.joinable())
+    writer.join();
+}
+
+void logger::run() {
+  for (;;) {
+    flush();
+
+    std::unique_lock lock{ mutex };
+    if (stopping)
+      break;
+
+    // A producer that sees the flag wakes us; the timeout covers a line
+    // pushed between the last flush and the flag being set
+    sleeping = true;
+    wake.wait_for(lock, std::chrono::milliseconds(50),
+        [this] { return !sleeping || stopping; });
+    sleeping = false;
+  }
+
+  flush();
+}
+
+void logger::flush() {
+  if (auto lost = dropped.exchange(0, std::memory_order_relaxed)) {
+    std::fprintf(stderr, "-- dropped %llu log lines\n", static_cast<unsigned long long>(lost));
+  }
+
+  bool wrote_out{ false }, wrote_err{ false };
+
+  while (ring.try_pop(
+        [&](const record& r) {
+          auto time = std::chrono::system_clock::to_time_t(r.time);
+          auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+              r.time.time_since_epoch()).count() % 1000;
+
+          std::tm tm{};
+          localtime_r(&time, &tm);
+          char stamp[16];
+          std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+
+          auto out = r.severity >= level::warn ? stderr : stdout;
+          auto tag = subsystem_tags[static_cast<std::size_t>(r.source)];
+
+          std::fprintf(out, "%s.%03d %-5s %.*s%.*s\n",
+              stamp, static_cast<int>(ms),
+              to_string(r.severity).data(),
+              static_cast<int>(tag.size()), tag.data(),
+              static_cast<int>(r.length), r.text);
+
+          (out == stderr ? wrote_err : wrote_out) = true;
+        })) {}
+
+  if (wrote_out)
+    std::fflush(stdout);
+  if (wrote_err)
+    std::fflush(stderr);
+}
+
+logger& global() {
+  static logger instance;
+  return instance;
+}
+
+} // namespace log
+
+} // namespace dc
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common.hpp"
+#include "metrics.hpp"
+#include "mpsc_ring.hpp"
+
+// Levels below this are compiled out: 0 trace, 1 debug, 2 info, 3 warn, 4 error
+#ifndef DC_LOG_LEVEL
+#define DC_LOG_LEVEL 0
+#endif
+
+namespace dc {
+
+namespace log {
+
+enum class level : std::uint8_t {
+  trace,
+  debug,
+  info,
+  warn,
+  error,
+  off,
+};
+
+enum class subsystem : std::uint8_t {
+  core,
+  twitch,
+  discord,
+  console,
+  database,
+  archive,
+  metrics,
+};
+
+constexpr std::size_t subsystem_count = 7;
+constexpr level compiled_level = static_cast<level>(DC_LOG_LEVEL);
+
+std::string_view to_string(level l);
+std::string_view to_string(subsystem s);
+std::optional<level> parse_level(std::string_view name);
+std::optional<subsystem> parse_subsystem(std::string_view name);
+
+std::error_code decode(const json::value& jv, level& l);
+
+struct settings {
+  level default_level{ level::info };
+  // spdlog level name for aegis
+  std::string aegis{ "warning" };
+  std::optional<level> core;
+  std::optional<level> twitch;
+  std::optional<level> discord;
+  std::optional<level> console;
+  std::optional<level> database;
+  std::optional<level> archive;
+  std::optional<level> metrics;
+};
+
+std::error_code decode(const json::value& jv, settings& s);
+
+/*
+ * Fixed size log line, formatted in place inside its ring slot. Anything
+ * past max_length is cut off.
+ */
+struct record {
+  static constexpr std::size_t max_length = 1000;
+
+  std::chrono::system_clock::time_point time;
+  level severity;
+  subsystem source;
+  std::uint16_t length;
+  char text[max_length];
+
+  void append(std::string_view s) {
+    auto n = std::min(s.size(), max_length - length);
+    std::copy_n(s.data(), n, text + length);
+    length += static_cast<std::uint16_t>(n);
+  }
+
+  template <class T>
+    void put(const T& value) {
+      if constexpr (std::is_same_v<T, char>) {
+        append({ &value, 1 });
+      } else if constexpr (std::is_same_v<T, bool>) {
+        append(value ? "true" : "false");
+      } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        append(std::string_view{ value });
+      } else if constexpr (std::is_integral_v<T>) {
+        char buffer[24];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        append({ buffer, static_cast<std::size_t>(result.ptr - buffer) });
+      } else if constexpr (std::is_enum_v<T>) {
+        put(static_cast<std::underlying_type_t<T>>(value));
+      } else {
+        // Cold path for endpoints, error codes and the like
+        std::ostringstream out;
+        out << value;
+        append(out.str());
+      }
+    }
+};
+
+/*
+ * Asynchronous logger. Callers format into a slot of a lock-free ring and
+ * return; a background thread writes the slots out. When the ring is full
+ * lines are dropped and counted rather than blocking the io threads.
+ */
+class logger {
+  mpsc_ring<record> ring;
+  std::array<std::atomic<level>, subsystem_count> levels;
+
+  std::atomic<std::uint64_t> dropped{ 0 };
+  metrics::counter& dropped_total;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> sleeping{ false };
+  std::atomic<bool> stopping{ false };
+  std::thread writer;
+
+public:
+  explicit logger(std::size_t capacity = 4096);
+  ~logger();
+
+  logger(const logger&) = delete;
+  logger& operator=(const logger&) = delete;
+
+  bool enabled(level severity, subsystem source) const {
+    return severity >= levels[static_cast<std::size_t>(source)].load(std::memory_order_relaxed);
+  }
+
+  template <class... Args>
+    void write(level severity, subsystem source, const Args&... args) {
+      if (!enabled(severity, source))
+        return;
+
+      auto pushed = ring.try_push(
+          [&](record& r) {
+            r.time = std::chrono::system_clock::now();
+            r.severity = severity;
+            r.source = source;
+            r.length = 0;
+            (r.put(args), ...);
+          });
+
+      if (!pushed) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        dropped_total.add();
+        return;
+      }
+
+      if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false))
+        wake.notify_one();
+    }
+
+  void configure(const settings& s);
+  void set_level(level severity);
+  void set_level(subsystem source, level severity);
+  level get_level(subsystem source) const;
+
+  // Writes out everything queued so far and stops the writer
+  void stop();
+
+private:
+  void run();
+  void flush();
+};
+
+logger& global();
+
+template <class... Args>
+void trace(subsystem source, const Args&... args) {
+  if constexpr (level::trace >= compiled_level)
+    global().write(level::trace, source, args...);
+}
+
+template <class... Args>
+void debug(subsystem source, const Args&... args) {
+  if constexpr (level::debug >= compiled_level)
+    global().write(level::debug, source, args...);
+}
+
+template <class... Args>
+void info(subsystem source, const Args&... args) {
+  if constexpr (level::info >= compiled_level)
+    global().write(level::info, source, args...);
+}
+
+template <class... Args>
+void warn(subsystem source, const Args&... args) {
+  if constexpr (level::warn >= compiled_level)
+    global().write(level::warn, source, args...);
+}
+
+template <class... Args>
+void error(subsystem source, const Args&... args) {
+  if constexpr (level::error >= compiled_level)
+    global().write(level::error, source, args...);
+}
+
+} // namespace log
+
+} // namespace dc
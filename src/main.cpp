@@ -1,23 +1,31 @@
 #include <cstdlib>
 #include <csignal>
+#include <ctime>
 #include <fstream>
 #include <iomanip>
-
-#include <boost/algorithm/string/trim.hpp>
+#include <thread>
 
 #include <sqlite3.h>
 
 #include <aegis.hpp>
 
-#include "twitch.hpp"
+#include "pool.hpp"
 #include "console.hpp"
+#include "log.hpp"
+#include "archive.hpp"
+#include "commands.hpp"
+#include "event_bus.hpp"
+#include "message_log.hpp"
+#include "message_search.hpp"
+#include "metrics.hpp"
+#include "timer_wheel.hpp"
 
 using namespace dc;
 
 std::shared_ptr<asio::io_context> io{ nullptr };
 
 void signal_handler(int sig) {
-  std::cout << "Caught Ctrl-C, stopping io context event loop...\n";
+  log::info(log::subsystem::core, "Caught Ctrl-C, stopping io context event loop...");
 
   io->stop();
 }
@@ -38,21 +46,49 @@ json::value read_json_file(const char* file, boost::system::error_code& error) {
   return p.release();
 }
 
-void greet(twitch::client& client, std::string_view who, std::string_view where, std::string_view message) {
-  std::string nick;
-
-  extract_regex_groups(who.data(), std::regex{ "([^!:]+)" }, std::tie(nick));
-  boost::algorithm::trim(nick);
-
-  std::cout << "NICK: " << nick << '\n';
+struct discord_settings {
+  std::string token;
+};
+
+struct config {
+  int threads{ 1 };
+  twitch::settings twitch;
+  console::settings console;
+  database::settings database;
+  metrics::settings metrics;
+  log::settings log;
+  commands::settings commands;
+  event_bus_settings events;
+  discord_settings discord;
+};
+
+constexpr auto discord_fields = std::make_tuple(
+    required("token", &discord_settings::token));
+
+constexpr auto config_fields = std::make_tuple(
+    optional("threads", &config::threads),
+    required("twitch", &config::twitch),
+    required("console", &config::console),
+    optional("database", &config::database),
+    optional("metrics", &config::metrics),
+    optional("log", &config::log),
+    optional("commands", &config::commands),
+    optional("events", &config::events),
+    required("discord", &config::discord));
+
+std::error_code decode(const json::value& jv, discord_settings& s) {
+  return decode_object(jv, s, discord_fields);
+}
 
-  if (nick == client.get_settings().nick) {
-    return;
-  }
+std::error_code decode(const json::value& jv, config& c) {
+  return decode_object(jv, c, config_fields);
+}
 
-  std::string dest{ where };
-  boost::algorithm::trim(dest);
-  client.say(dest, "Hello, " + nick + "!");
+void greet(const commands::context& ctx) {
+  std::string greeting{ "Hello, " };
+  greeting += ctx.nick;
+  greeting += '!';
+  ctx.reply(greeting);
 }
 
 int main(int argc, char* argv[]) {
@@ -64,96 +100,285 @@ int main(int argc, char* argv[]) {
   boost::system::error_code error;
   auto secret = read_json_file(argv[1], error);
   if (error) {
-    std::cerr << "Failed to read config: " << error.message() << '\n';
+    log::error(log::subsystem::core, "Failed to read config: ", error.message());
+    return EXIT_FAILURE;
+  }
+
+  config config;
+  if (auto ec = decode(secret, config)) {
+    log::error(log::subsystem::core, "Invalid config: ", ec.message());
     return EXIT_FAILURE;
   }
 
-  dc::twitch::settings settings{ json::value_to<dc::twitch::settings>(secret.at("twitch")) };
+  log::global().configure(config.log);
 
-  std::cout << "SQLite threadsafe: " << sqlite3_threadsafe() << '\n';
+  log::info(log::subsystem::core, "SQLite threadsafe: ", sqlite3_threadsafe());
   sqlite3 *db{ nullptr };
   auto rc = sqlite3_open(argv[2], &db);
   if (rc) {
-    std::cerr << "Can' open database: " << sqlite3_errmsg(db) << '\n';
+    log::error(log::subsystem::core, "Can't open database: ", sqlite3_errmsg(db));
     sqlite3_close(db);
     return EXIT_FAILURE;
   } else {
-    std::cout << "Database: " << argv[2] << '\n';
+    log::info(log::subsystem::core, "Database: ", argv[2]);
   }
 
+  database::message_log message_log{ db, config.database };
+  database::message_search message_search{ argv[2], config.database.archive_dir };
+
+  std::optional<database::archiver> archiver;
+  if (config.database.archive_after > 0)
+    archiver.emplace(argv[2], config.database);
+
   using asio::ip::tcp;
-  io = std::make_shared<asio::io_context>();
+  auto threads = std::max(1, config.threads);
+  io = std::make_shared<asio::io_context>(threads);
+
+  timer_service timers{ *io, static_cast<std::size_t>(threads) };
 
   asio::ssl::context ssl_ctx{ asio::ssl::context::tls };
   ssl_ctx.set_default_verify_paths();
 
-  twitch::client twitch{ *io, ssl_ctx, settings };
+  twitch::pool twitch{ *io, ssl_ctx, timers, config.twitch };
 
-  twitch.register_handler("001", [&](auto&&...) {
-    for (const auto& channel: settings.channels) {
-      twitch.join(channel);
-    }
+  dc::console::server console{ *io, config.console };
+
+  std::optional<metrics::http_server> metrics_server;
+  if (config.metrics.enabled)
+    metrics_server.emplace(*io, config.metrics, metrics::global());
+
+  commands::router router{ config.commands, *io, timers };
+
+  router.add("hello", greet, { std::chrono::seconds(30), std::chrono::seconds(5) });
+  router.alias("hi", "hello");
+
+  router.add("commands",
+      [&router](const commands::context& ctx) {
+        std::string list;
+        for (auto name: router.names())
+          list.append(list.empty() ? "" : ", ").append(name);
+        ctx.reply(list);
+      },
+      { std::chrono::seconds(0), std::chrono::seconds(30) });
+
+  router.add_task("messages",
+      [&](const commands::context& ctx) -> asio::awaitable<void> {
+        database::aggregate today;
+        today.channel = ctx.channel;
+        today.since = std::time(nullptr) / 86400 * 86400;
+
+        auto result = co_await message_search.async_count(std::move(today), asio::use_awaitable);
+        if (!result.error.empty())
+          co_return;
+
+        std::uint64_t total{ 0 };
+        for (const auto& [name, count]: result.groups)
+          total += count;
+
+        ctx.reply(std::to_string(total) + " messages in " + std::string{ ctx.channel } + " today");
+      },
+      { std::chrono::seconds(0), std::chrono::seconds(60) });
+
+  commands::responder twitch_reply = [&](std::string_view channel, std::string_view text) {
+    twitch.say(channel, text);
+  };
+
+  // Chat handlers run on the bus workers; the clients keep PING, 001 and
+  // the room state on the io threads
+  event_bus events{ config.events };
+
+  events.subscribe([&](const chat_event& event) {
+    std::string line{ event.source == platform::twitch ? "[Twitch] " : "[Discord] " };
+    line.append(event.channel).append(" <").append(event.author).append("> ").append(event.text);
+    console.publish(event.channel, line);
+
+    if (event.source == platform::twitch)
+      message_log.push({ event.timestamp, event.author, event.channel, event.text });
   });
 
-  twitch.register_handler("PRIVMSG",
-    [&](auto&& who, auto&& where, auto&& message) {
-      std::string nick;
-      extract_regex_groups(who.data(), std::regex{ "([^!:]+)" }, std::tie(nick));
-      boost::algorithm::trim(nick);
+  events.subscribe([&](const chat_event& event) {
+    if (event.source != platform::twitch || event.author == twitch.get_settings().nick)
+      return;
 
-      std::string channel{ where };
-      boost::algorithm::trim(channel);
+    router.dispatch(event.channel, event.author, event.text, twitch_reply);
+  });
 
+  twitch.register_handler("PRIVMSG",
+    [&](const irc::message& msg) {
       auto now = std::chrono::system_clock::now();
       auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(
           now.time_since_epoch()).count();
 
-      std::stringstream sql;
-      sql << "INSERT INTO message (timestamp, nick, channel, message) "
-          << "VALUES ("
-          << timestamp << ", "
-          << std::quoted(nick) << ", "
-          << std::quoted(channel) << ", "
-          << std::quoted(message)
-          << ");";
-      std::cout << "Executing: " << sql.str() << '\n';
-
-      char *error{ nullptr };
-      auto rc = sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &error);
-      if (rc) {
-        std::cerr << "SQL Error: " << error << '\n';
-      }
+      events.publish({
+        platform::twitch,
+        std::string{ msg.param(0) },
+        std::string{ msg.nick() },
+        std::string{ msg.trailing() },
+        timestamp
+      });
     }
   );
 
+  twitch.set_read_gate([&events] { return events.congested(); });
+
   std::signal(SIGINT, signal_handler);
 
-  dc::console::server console{ *io, json::value_to<dc::console::settings>(secret.at("console")) };
+  console.register_handler("db", [&](console::connection::pointer client, auto) {
+    auto stats = message_log.get_stats();
+    std::stringstream out;
+    out << "[Database] queue: " << stats.queue_depth
+      << ", written: " << stats.written
+      << ", failed: " << stats.failed
+      << ", dropped: " << stats.dropped
+      << ", commits: " << stats.commits
+      << ", last commit: " << stats.last_commit.count() << "us"
+      << ", max commit: " << stats.max_commit.count() << "us";
+
+    if (archiver) {
+      auto archived = archiver->get_stats();
+      out << "\n[Archive] days: " << archived.days
+        << ", rows: " << archived.rows
+        << ", bytes: " << archived.bytes;
+    }
+
+    client->send_line(out.str());
+  });
+
+  console.register_handler("stats", [](console::connection::pointer client, auto) {
+    std::stringstream out;
+    metrics::global().write_summary(out);
+    client->send(out.str());
+  });
+
+  console.register_handler("loglevel", [](console::connection::pointer client, std::string_view args) {
+    auto space = args.find(' ');
+    auto first = args.substr(0, space);
+    auto second = space == std::string_view::npos ? std::string_view{} : args.substr(space + 1);
+
+    if (!first.empty()) {
+      auto source = log::parse_subsystem(first);
+      auto severity = log::parse_level(source ? second : first);
+
+      if (!severity || (!source && !second.empty())) {
+        client->send_line("usage: loglevel [subsystem] [trace|debug|info|warn|error|off]");
+        return;
+      }
+
+      if (source)
+        log::global().set_level(*source, *severity);
+      else
+        log::global().set_level(*severity);
+    }
+
+    std::stringstream out;
+    for (std::size_t i = 0; i < log::subsystem_count; ++i) {
+      auto source = static_cast<log::subsystem>(i);
+      out << log::to_string(source) << ": " << log::to_string(log::global().get_level(source)) << '\n';
+    }
+    client->send(out.str());
+  });
+
+  console.register_task("count",
+      [&](console::connection::pointer client, std::string args) -> asio::awaitable<void> {
+        auto aggregate = database::parse_aggregate(args);
+        auto result = co_await message_search.async_count(std::move(aggregate), asio::use_awaitable);
+
+        if (!result.error.empty()) {
+          client->send_line("count failed: " + result.error);
+          co_return;
+        }
+
+        std::size_t shown{ 0 };
+        for (const auto& [name, count]: result.groups) {
+          if (shown++ == 20)
+            break;
+          client->send_line(std::to_string(count) + ' ' + name);
+        }
+
+        std::stringstream line;
+        line << "-- " << result.live_rows << " live, " << result.archived_rows
+          << " archived in " << result.segments << " segments, "
+          << result.elapsed.count() << "us";
+        client->send_line(line.str());
+      });
+
+  console.register_task("search",
+      [&](console::connection::pointer client, std::string args) -> asio::awaitable<void> {
+        auto query = database::parse_query(args);
+        auto page = query.page;
+
+        auto [rows, error] = co_await message_search.async_search(std::move(query),
+            asio::use_awaitable);
+
+        if (!error.empty()) {
+          client->send_line("search failed: " + error);
+          co_return;
+        }
+
+        for (const auto& row: rows) {
+          std::time_t time = row.timestamp;
+          std::tm tm{};
+          gmtime_r(&time, &tm);
+
+          std::stringstream line;
+          line << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << ' '
+            << row.channel << " <" << row.nick << "> " << row.text;
+          client->send_line(line.str());
+        }
+
+        std::stringstream line;
+        line << "-- page " << page << ", " << rows.size() << " results";
+        if (rows.size() == database::query::page_size)
+          line << ", next: page:" << page + 1;
+        client->send_line(line.str());
+      });
 
-  auto token = json::value_to<std::string>(secret.at("discord").at("token"));
   aegis::core discord(aegis::create_bot_t()
-      .log_level(spdlog::level::trace)
+      .log_level(spdlog::level::from_str(config.log.aegis))
       .io_context(io)
-      .token(token));
+      .token(config.discord.token));
 
   discord.set_on_message_create([&](aegis::gateway::events::message_create obj) {
-        std::string content{ obj.msg.get_content() };
-        auto& channel = obj.msg.get_channel();
-        auto& author = obj.msg.get_user();
-
-        std::cout << "[" << channel.get_name() << "] " << author.get_username() << ": " << content << '\n';
+        auto now = std::chrono::system_clock::now();
+        auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+            now.time_since_epoch()).count();
+
+        events.publish({
+          platform::discord,
+          "#" + obj.msg.get_channel().get_name(),
+          obj.msg.get_user().get_username(),
+          obj.msg.get_content(),
+          timestamp
+        });
       });
 
+  events.start();
   discord.run();
+
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i)
+    workers.emplace_back([] { io->run(); });
+
   io->run();
 
-  std::cout << "Disconnected.\n";
+  for (auto& worker: workers)
+    worker.join();
+
+  log::info(log::subsystem::core, "Disconnected.");
+
+  events.stop();
+  message_search.stop();
+  if (archiver)
+    archiver->stop();
+  message_log.stop();
 
   rc = sqlite3_close(db);
   if (rc == SQLITE_OK)
-    std::cout << "Database closed\n";
+    log::info(log::subsystem::core, "Database closed");
   else
-    std::cerr << "Failed to close database\n";
+    log::error(log::subsystem::core, "Failed to close database");
+
+  log::global().stop();
 
   return 0;
 }
@@ -0,0 +1,257 @@
+#include "message_log.hpp"
+
+#include "log.hpp"
+
+namespace dc {
+
+namespace database {
+
+constexpr auto settings_fields = std::make_tuple(
+    optional("queue_size", &settings::queue_size),
+    optional("batch_size", &settings::batch_size),
+    optional("flush_interval", &settings::flush_interval),
+    optional("archive_after", &settings::archive_after),
+    optional("archive_dir", &settings::archive_dir),
+    optional("archive_interval", &settings::archive_interval));
+
+std::error_code decode(const json::value& jv, settings& s) {
+  return decode_object(jv, s, settings_fields);
+}
+
+message_log::message_log(sqlite3* db, const settings& settings)
+  : db(db)
+  , settings_(settings)
+  , queued(metrics::global().get_gauge("dc_database_queued_messages", "Messages waiting to be written"))
+  , dropped_total(metrics::global().get_counter("dc_database_dropped_total", "Messages dropped on a full queue"))
+  , failed_total(metrics::global().get_counter("dc_database_failed_total", "Messages that could not be written"))
+  , insert_time(metrics::global().get_histogram("dc_database_insert_nanoseconds", "Time to insert one row"))
+  , commit_time(metrics::global().get_histogram("dc_database_commit_nanoseconds", "Time to write and commit one batch"))
+{
+  exec("PRAGMA journal_mode=WAL;");
+  exec("PRAGMA synchronous=NORMAL;");
+
+  // The archiver writes through its own connection
+  sqlite3_busy_timeout(db, 5000);
+
+  create_indexes();
+
+  static constexpr auto sql =
+    "INSERT INTO message (timestamp, nick, channel, message) VALUES (?, ?, ?, ?);";
+
+  if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &insert, nullptr) != SQLITE_OK) {
+    std::stringstream msg;
+    msg << "Failed to prepare insert: " << sqlite3_errmsg(db);
+    throw std::runtime_error(msg.str());
+  }
+
+  worker = std::thread{ [this] { run(); } };
+}
+
+void message_log::create_indexes() {
+  exec("CREATE INDEX IF NOT EXISTS message_channel_timestamp ON message (channel, timestamp);");
+  exec("CREATE INDEX IF NOT EXISTS message_nick_timestamp ON message (nick, timestamp);");
+
+  bool fts_exists{ false };
+  exec("SELECT 1 FROM sqlite_master WHERE name = 'message_fts';",
+      [](void* exists, int, char**, char**) {
+        *static_cast<bool*>(exists) = true;
+        return 0;
+      }, &fts_exists);
+
+  if (fts_exists)
+    return;
+
+  // Triggers committed without their table would fail every insert
+  exec("DROP TRIGGER IF EXISTS message_fts_insert;");
+  exec("DROP TRIGGER IF EXISTS message_fts_delete;");
+  exec("DROP TRIGGER IF EXISTS message_fts_update;");
+
+  // External content table: the text lives in `message` only, the FTS
+  // table just holds the index
+  auto created = exec("BEGIN;")
+    && exec("CREATE VIRTUAL TABLE message_fts USING fts5("
+            "message, content='message', content_rowid='id');")
+    && exec("CREATE TRIGGER message_fts_insert AFTER INSERT ON message BEGIN "
+            "INSERT INTO message_fts (rowid, message) VALUES (new.id, new.message); "
+            "END;")
+    && exec("CREATE TRIGGER message_fts_delete AFTER DELETE ON message BEGIN "
+            "INSERT INTO message_fts (message_fts, rowid, message) VALUES ('delete', old.id, old.message); "
+            "END;")
+    && exec("CREATE TRIGGER message_fts_update AFTER UPDATE ON message BEGIN "
+            "INSERT INTO message_fts (message_fts, rowid, message) VALUES ('delete', old.id, old.message); "
+            "INSERT INTO message_fts (rowid, message) VALUES (new.id, new.message); "
+            "END;");
+
+  if (created) {
+    log::info(log::subsystem::database, "Building full-text index");
+    created = exec("INSERT INTO message_fts (message_fts) VALUES ('rebuild');")
+      && exec("COMMIT;");
+  }
+
+  if (!created) {
+    if (!sqlite3_get_autocommit(db))
+      exec("ROLLBACK;");
+    log::warn(log::subsystem::database, "Full-text index unavailable, text search is disabled");
+  }
+}
+
+message_log::~message_log() {
+  stop();
+}
+
+bool message_log::push(message msg, write_handler done) {
+  {
+    std::lock_guard lock{ mutex };
+    if (stopping || queue.size() >= settings_.queue_size) {
+      dropped++;
+      dropped_total.add();
+      if (done)
+        done(std::make_error_code(std::errc::no_buffer_space));
+      return false;
+    }
+
+    queue.push_back({ std::move(msg), std::move(done), {} });
+    queued.set(static_cast<std::int64_t>(queue.size()));
+  }
+
+  wake.notify_one();
+  return true;
+}
+
+void message_log::stop() {
+  {
+    std::lock_guard lock{ mutex };
+    stopping = true;
+  }
+
+  wake.notify_one();
+
+  if (worker.joinable())
+    worker.join();
+
+  if (insert) {
+    sqlite3_finalize(insert);
+    insert = nullptr;
+  }
+}
+
+message_log::stats message_log::get_stats() const {
+  std::size_t depth;
+  {
+    std::lock_guard lock{ mutex };
+    depth = queue.size();
+  }
+
+  return {
+    depth,
+    written.load(),
+    failed.load(),
+    dropped.load(),
+    commits.load(),
+    std::chrono::microseconds(last_commit_us.load()),
+    std::chrono::microseconds(max_commit_us.load())
+  };
+}
+
+void message_log::run() {
+  std::vector<pending> batch;
+  batch.reserve(settings_.batch_size);
+
+  std::unique_lock lock{ mutex };
+
+  for (;;) {
+    wake.wait_for(lock, std::chrono::milliseconds(settings_.flush_interval),
+        [this] { return stopping || queue.size() >= settings_.batch_size; });
+
+    if (queue.empty()) {
+      if (stopping)
+        return;
+      continue;
+    }
+
+    while (!queue.empty() && batch.size() < settings_.batch_size) {
+      batch.push_back(std::move(queue.front()));
+      queue.pop_front();
+    }
+    queued.set(static_cast<std::int64_t>(queue.size()));
+
+    lock.unlock();
+    auto result = commit(batch) ? std::error_code{} : std::make_error_code(std::errc::io_error);
+    for (auto& row: batch) {
+      if (row.done)
+        row.done(result ? result : row.result);
+    }
+    batch.clear();
+    lock.lock();
+  }
+}
+
+bool message_log::commit(std::vector<pending>& batch) {
+  auto start = std::chrono::steady_clock::now();
+
+  if (!exec("BEGIN;")) {
+    failed += batch.size();
+    failed_total.add(batch.size());
+    return false;
+  }
+
+  std::uint64_t inserted{ 0 };
+  for (auto& row: batch) {
+    const auto& msg = row.msg;
+    auto row_start = std::chrono::steady_clock::now();
+
+    sqlite3_bind_int64(insert, 1, msg.timestamp);
+    sqlite3_bind_text(insert, 2, msg.nick.data(), static_cast<int>(msg.nick.size()), SQLITE_STATIC);
+    sqlite3_bind_text(insert, 3, msg.channel.data(), static_cast<int>(msg.channel.size()), SQLITE_STATIC);
+    sqlite3_bind_text(insert, 4, msg.text.data(), static_cast<int>(msg.text.size()), SQLITE_STATIC);
+
+    if (sqlite3_step(insert) == SQLITE_DONE) {
+      inserted++;
+    } else {
+      log::error(log::subsystem::database, "Insert failed: ", sqlite3_errmsg(db));
+      row.result = std::make_error_code(std::errc::io_error);
+    }
+
+    sqlite3_reset(insert);
+    insert_time.record(std::chrono::steady_clock::now() - row_start);
+  }
+
+  sqlite3_clear_bindings(insert);
+
+  if (!exec("COMMIT;")) {
+    exec("ROLLBACK;");
+    failed += batch.size();
+    failed_total.add(batch.size());
+    return false;
+  }
+
+  auto duration = std::chrono::steady_clock::now() - start;
+  commit_time.record(duration);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+
+  written += inserted;
+  failed += batch.size() - inserted;
+  failed_total.add(batch.size() - inserted);
+  commits++;
+  last_commit_us = elapsed;
+  if (elapsed > max_commit_us)
+    max_commit_us = elapsed;
+
+  return true;
+}
+
+bool message_log::exec(const char* sql, exec_callback callback, void* arg) {
+  char* error{ nullptr };
+  if (sqlite3_exec(db, sql, callback, arg, &error) != SQLITE_OK) {
+    log::error(log::subsystem::database, sql, " failed: ", error);
+    sqlite3_free(error);
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace database
+
+} // namespace dc
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "async.hpp"
+#include "common.hpp"
+#include "metrics.hpp"
+
+namespace dc {
+
+namespace database {
+
+struct settings {
+  std::size_t queue_size{ 65536 };
+  std::size_t batch_size{ 256 };
+  int flush_interval{ 250 };
+  int archive_after{ 0 };
+  std::string archive_dir{ "archive" };
+  int archive_interval{ 3600 };
+};
+
+std::error_code decode(const json::value& jv, settings& s);
+
+struct message {
+  std::int64_t timestamp;
+  std::string nick;
+  std::string channel;
+  std::string text;
+};
+
+/*
+ * Writes chat messages to the `message` table from a dedicated thread.
+ * Rows are committed in groups, either when batch_size rows are pending
+ * or flush_interval milliseconds have passed. The search indexes are
+ * created on startup and kept in sync by triggers.
+ */
+class message_log {
+public:
+  // Told once the row is committed, or why it never will be
+  using write_handler = std::function<void(std::error_code)>;
+
+  struct stats {
+    std::size_t queue_depth;
+    std::uint64_t written;
+    std::uint64_t failed;
+    std::uint64_t dropped;
+    std::uint64_t commits;
+    std::chrono::microseconds last_commit;
+    std::chrono::microseconds max_commit;
+  };
+
+private:
+  struct pending {
+    message msg;
+    write_handler done;
+    // Set when this row's insert failed
+    std::error_code result;
+  };
+
+  sqlite3* db;
+  settings settings_;
+  sqlite3_stmt* insert{ nullptr };
+
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<pending> queue;
+  bool stopping{ false };
+
+  std::atomic<std::uint64_t> written{ 0 };
+  std::atomic<std::uint64_t> failed{ 0 };
+  std::atomic<std::uint64_t> dropped{ 0 };
+  std::atomic<std::uint64_t> commits{ 0 };
+  std::atomic<std::int64_t> last_commit_us{ 0 };
+  std::atomic<std::int64_t> max_commit_us{ 0 };
+
+  metrics::gauge& queued;
+  metrics::counter& dropped_total;
+  metrics::counter& failed_total;
+  metrics::histogram& insert_time;
+  metrics::histogram& commit_time;
+
+  std::thread worker;
+
+public:
+  message_log(sqlite3* db, const settings& settings);
+  ~message_log();
+
+  message_log(const message_log&) = delete;
+  message_log& operator=(const message_log&) = delete;
+
+  bool push(message msg, write_handler done = {});
+
+  template <class CompletionToken>
+    auto async_write(message msg, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(std::error_code)>(
+          [this](auto handler, message msg) {
+            push(std::move(msg), make_completion<std::error_code>(std::move(handler), asio::system_executor{}));
+          }, token, std::move(msg));
+    }
+
+  void stop();
+
+  stats get_stats() const;
+
+private:
+  using exec_callback = int (*)(void*, int, char**, char**);
+
+  void create_indexes();
+  void run();
+  bool commit(std::vector<pending>& batch);
+  bool exec(const char* sql, exec_callback callback = nullptr, void* arg = nullptr);
+};
+
+} // namespace database
+
+} // namespace dc
@@ -0,0 +1,383 @@
+#include "message_search.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "archive.hpp"
+
+#include "log.hpp"
+
+namespace dc {
+
+namespace database {
+
+query parse_query(std::string_view input) {
+  query q;
+
+  while (!input.empty()) {
+    auto space = input.find(' ');
+    auto word = input.substr(0, space);
+    input = space == std::string_view::npos ? std::string_view{} : input.substr(space + 1);
+
+    if (word.empty())
+      continue;
+
+    if (word.size() > 1 && word.front() == '#') {
+      q.channel = word;
+    } else if (word.size() > 1 && word.front() == '@') {
+      q.nick = word.substr(1);
+    } else if (word.substr(0, 5) == "page:") {
+      q.page = std::strtoul(std::string{ word.substr(5) }.c_str(), nullptr, 10);
+    } else {
+      if (!q.text.empty())
+        q.text += ' ';
+      q.text += word;
+    }
+  }
+
+  return q;
+}
+
+aggregate parse_aggregate(std::string_view input) {
+  aggregate a;
+
+  while (!input.empty()) {
+    auto space = input.find(' ');
+    auto word = input.substr(0, space);
+    input = space == std::string_view::npos ? std::string_view{} : input.substr(space + 1);
+
+    if (word == "by:nick") {
+      a.by = aggregate::group::nick;
+    } else if (word == "by:channel") {
+      a.by = aggregate::group::channel;
+    } else if (word.size() > 1 && word.front() == '#') {
+      a.channel = word;
+    } else if (word.size() > 1 && word.front() == '@') {
+      a.nick = word.substr(1);
+    } else if (word.substr(0, 5) == "days:") {
+      auto days = std::strtoll(std::string{ word.substr(5) }.c_str(), nullptr, 10);
+      auto now = std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+      a.since = now - days * 86400;
+    }
+  }
+
+  return a;
+}
+
+message_search::message_search(const std::string& path, const std::string& archive_dir)
+  : archive_dir(archive_dir)
+{
+  auto flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+  if (sqlite3_open_v2(path.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+    std::stringstream msg;
+    msg << "Failed to open search connection: " << sqlite3_errmsg(db);
+    sqlite3_close(db);
+    throw std::runtime_error(msg.str());
+  }
+
+  sqlite3_exec(db, "SELECT 1 FROM sqlite_master WHERE name = 'message_fts';",
+      [](void* exists, int, char**, char**) {
+        *static_cast<bool*>(exists) = true;
+        return 0;
+      }, &full_text, nullptr);
+
+  worker = std::thread{ [this] { run(); } };
+}
+
+message_search::~message_search() {
+  stop();
+}
+
+void message_search::search(query q, row_handler on_row, done_handler on_done) {
+  post([this, q = std::move(q), on_row = std::move(on_row), on_done = std::move(on_done)](bool stopped) {
+        if (stopped)
+          on_done(0, "search stopped");
+        else
+          execute(q, on_row, on_done);
+      });
+}
+
+void message_search::count(aggregate a, count_handler on_done) {
+  post([this, a = std::move(a), on_done = std::move(on_done)](bool stopped) {
+        if (stopped) {
+          counts result;
+          result.error = "search stopped";
+          on_done(result);
+        } else {
+          execute(a, on_done);
+        }
+      });
+}
+
+void message_search::post(job j) {
+  bool queued{ false };
+  {
+    std::lock_guard lock{ mutex };
+    if (!stopping) {
+      jobs.push_back(std::move(j));
+      queued = true;
+    }
+  }
+
+  // Still told, so an awaiting caller is not left hanging
+  if (!queued) {
+    j(true);
+    return;
+  }
+
+  wake.notify_one();
+}
+
+void message_search::stop() {
+  std::deque<job> dropped;
+  {
+    std::lock_guard lock{ mutex };
+    stopping = true;
+    dropped.swap(jobs);
+  }
+
+  wake.notify_one();
+
+  for (auto& j: dropped)
+    j(true);
+
+  if (worker.joinable())
+    worker.join();
+
+  if (db) {
+    sqlite3_close(db);
+    db = nullptr;
+  }
+}
+
+void message_search::run() {
+  std::unique_lock lock{ mutex };
+
+  for (;;) {
+    wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+    if (stopping)
+      return;
+
+    auto next = std::move(jobs.front());
+    jobs.pop_front();
+
+    lock.unlock();
+    next(false);
+    lock.lock();
+  }
+}
+
+void message_search::execute(const query& q, const row_handler& on_row, const done_handler& on_done) {
+  // Filters are only added when set so SQLite can pick the matching
+  // (channel, timestamp) or (nick, timestamp) index
+  if (!q.text.empty() && !full_text) {
+    on_done(0, "full-text search is unavailable");
+    return;
+  }
+
+  std::string sql;
+  if (!q.text.empty()) {
+    sql = "SELECT m.timestamp, m.nick, m.channel, m.message FROM message_fts "
+          "JOIN message m ON m.id = message_fts.rowid "
+          "WHERE message_fts MATCH :text";
+  } else {
+    sql = "SELECT m.timestamp, m.nick, m.channel, m.message FROM message m WHERE 1";
+  }
+
+  if (!q.channel.empty())
+    sql += " AND m.channel = :channel";
+  if (!q.nick.empty())
+    sql += " AND m.nick = :nick";
+
+  sql += " ORDER BY m.timestamp DESC LIMIT :limit OFFSET :offset;";
+
+  sqlite3_stmt* stmt{ nullptr };
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    on_done(0, sqlite3_errmsg(db));
+    return;
+  }
+
+  auto bind = [stmt](const char* name, const std::string& value) {
+    auto index = sqlite3_bind_parameter_index(stmt, name);
+    if (index)
+      sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+  };
+
+  bind(":text", q.text);
+  bind(":channel", q.channel);
+  bind(":nick", q.nick);
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":limit"),
+      static_cast<sqlite3_int64>(query::page_size));
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":offset"),
+      static_cast<sqlite3_int64>(q.page * query::page_size));
+
+  auto text = [stmt](int column) {
+    auto data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+    return std::string{ data ? data : "", static_cast<std::size_t>(sqlite3_column_bytes(stmt, column)) };
+  };
+
+  std::size_t rows{ 0 };
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    on_row({ sqlite3_column_int64(stmt, 0), text(1), text(2), text(3) });
+    rows++;
+  }
+
+  std::string error;
+  if (rc != SQLITE_DONE)
+    error = sqlite3_errmsg(db);
+
+  sqlite3_finalize(stmt);
+
+  on_done(rows, error);
+}
+
+void message_search::execute(const aggregate& a, const count_handler& on_done) {
+  auto start = std::chrono::steady_clock::now();
+
+  counts result;
+  std::unordered_map<std::string, std::uint64_t> totals;
+
+  // One read transaction: the live count and the checks against every
+  // segment see the same snapshot, so rows the archiver moves meanwhile
+  // are counted exactly once
+  sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+
+  count_live(a, totals, result);
+  if (result.error.empty())
+    count_archived(a, totals, result);
+
+  sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+  result.groups.assign(totals.begin(), totals.end());
+  std::sort(result.groups.begin(), result.groups.end(),
+      [](const auto& x, const auto& y) { return x.second > y.second; });
+
+  result.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  on_done(result);
+}
+
+void message_search::count_live(const aggregate& a,
+    std::unordered_map<std::string, std::uint64_t>& totals, counts& result) {
+  std::string column = a.by == aggregate::group::nick ? "nick" : "channel";
+
+  std::string sql = "SELECT " + column + ", COUNT(*) FROM message WHERE timestamp >= :since";
+  if (!a.channel.empty())
+    sql += " AND channel = :channel";
+  if (!a.nick.empty())
+    sql += " AND nick = :nick";
+  sql += " GROUP BY " + column + ";";
+
+  sqlite3_stmt* stmt{ nullptr };
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    result.error = sqlite3_errmsg(db);
+    return;
+  }
+
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":since"), a.since);
+  if (auto index = sqlite3_bind_parameter_index(stmt, ":channel"))
+    sqlite3_bind_text(stmt, index, a.channel.data(), static_cast<int>(a.channel.size()), SQLITE_STATIC);
+  if (auto index = sqlite3_bind_parameter_index(stmt, ":nick"))
+    sqlite3_bind_text(stmt, index, a.nick.data(), static_cast<int>(a.nick.size()), SQLITE_STATIC);
+
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    auto key = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    auto count = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 1));
+    totals[key ? key : ""] += count;
+    result.live_rows += count;
+  }
+
+  if (rc != SQLITE_DONE)
+    result.error = sqlite3_errmsg(db);
+
+  sqlite3_finalize(stmt);
+}
+
+void message_search::count_archived(const aggregate& a,
+    std::unordered_map<std::string, std::uint64_t>& totals, counts& result) {
+  std::error_code ec;
+  std::filesystem::directory_iterator it{ archive_dir, ec };
+  if (ec)
+    return;
+
+  // Segments are named after their day, so whole days before `since` are
+  // skipped without being opened
+  auto first = segment_path(archive_dir, a.since - a.since % 86400);
+
+  // The archiver deletes a day's rows in one transaction after writing the
+  // segment, so rows of that day still in the snapshot are a suffix of the
+  // segment by id (later stragglers sort after it). Those were counted live.
+  std::unordered_map<std::int64_t, std::int64_t> live_from;
+
+  sqlite3_stmt* stmt{ nullptr };
+  auto sql = "SELECT timestamp - timestamp % 86400, MIN(id) FROM message WHERE timestamp >= ? GROUP BY 1;";
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    result.error = sqlite3_errmsg(db);
+    return;
+  }
+
+  sqlite3_bind_int64(stmt, 1, a.since - a.since % 86400);
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    live_from[sqlite3_column_int64(stmt, 0)] = sqlite3_column_int64(stmt, 1);
+  sqlite3_finalize(stmt);
+
+  for (const auto& entry: it) {
+    const auto& path = entry.path();
+    if (path.extension() != ".seg" || path.string() < first)
+      continue;
+
+    try {
+      segment seg{ path.string() };
+      result.segments++;
+
+      auto lookup = [](const std::vector<std::string_view>& dict, const std::string& value) {
+        if (value.empty())
+          return std::optional<std::uint32_t>{};
+        auto found = std::find(dict.begin(), dict.end(), value);
+        return std::make_optional(static_cast<std::uint32_t>(
+              found == dict.end() ? dict.size() : found - dict.begin()));
+      };
+
+      auto channel = lookup(seg.channels(), a.channel);
+      auto nick = lookup(seg.nicks(), a.nick);
+
+      if ((channel && *channel == seg.channels().size()) || (nick && *nick == seg.nicks().size()))
+        continue;
+
+      auto live_it = live_from.find(seg.day());
+      auto live = live_it != live_from.end() ? live_it->second : std::numeric_limits<std::int64_t>::max();
+
+      bool by_nick = a.by == aggregate::group::nick;
+      std::vector<std::uint64_t> group_counts((by_nick ? seg.nicks() : seg.channels()).size());
+
+      seg.scan([&](std::int64_t id, std::int64_t timestamp, std::uint32_t n, std::uint32_t c) {
+            if (id >= live || timestamp < a.since || (channel && c != *channel) || (nick && n != *nick))
+              return;
+
+            auto group = by_nick ? n : c;
+            if (group < group_counts.size())
+              group_counts[group]++;
+          });
+
+      const auto& names = by_nick ? seg.nicks() : seg.channels();
+      for (std::size_t i = 0; i < group_counts.size(); ++i) {
+        if (!group_counts[i])
+          continue;
+
+        totals[std::string{ names[i] }] += group_counts[i];
+        result.archived_rows += group_counts[i];
+      }
+    } catch (const std::exception& e) {
+      log::error(log::subsystem::archive, e.what());
+    }
+  }
+}
+
+} // namespace database
+
+} // namespace dc
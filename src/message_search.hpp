@@ -0,0 +1,122 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "async.hpp"
+#include "message_log.hpp"
+
+namespace dc {
+
+namespace database {
+
+struct query {
+  static constexpr std::size_t page_size = 20;
+
+  std::string text;
+  std::string nick;
+  std::string channel;
+  std::size_t page{ 0 };
+};
+
+// Parses `[#channel] [@nick] [page:N] [terms...]`
+query parse_query(std::string_view input);
+
+struct aggregate {
+  enum class group { channel, nick };
+
+  group by{ group::channel };
+  std::string nick;
+  std::string channel;
+  std::int64_t since{ 0 };
+};
+
+// Parses `[by:channel|by:nick] [#channel] [@nick] [days:N]`
+aggregate parse_aggregate(std::string_view input);
+
+/*
+ * Runs searches against the message log on its own read-only connection
+ * and thread, so a slow query never holds up ingestion. Rows are handed to
+ * the callback as they are stepped, newest first. Aggregates also scan the
+ * archived day segments.
+ */
+class message_search {
+public:
+  using row_handler = std::function<void(const message& row)>;
+  using done_handler = std::function<void(std::size_t rows, const std::string& error)>;
+
+  struct counts {
+    std::vector<std::pair<std::string, std::uint64_t>> groups;
+    std::uint64_t live_rows{ 0 };
+    std::uint64_t archived_rows{ 0 };
+    std::size_t segments{ 0 };
+    std::chrono::microseconds elapsed{ 0 };
+    std::string error;
+  };
+
+  using count_handler = std::function<void(const counts& result)>;
+
+private:
+  // Called with true instead of being run once the search is stopped
+  using job = std::function<void(bool stopped)>;
+
+  sqlite3* db{ nullptr };
+  std::string archive_dir;
+  // False when SQLite was built without FTS5
+  bool full_text{ false };
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<job> jobs;
+  bool stopping{ false };
+
+  std::thread worker;
+
+public:
+  message_search(const std::string& path, const std::string& archive_dir);
+  ~message_search();
+
+  message_search(const message_search&) = delete;
+  message_search& operator=(const message_search&) = delete;
+
+  void search(query q, row_handler on_row, done_handler on_done);
+  void count(aggregate a, count_handler on_done);
+
+  // Completes with (rows, error); a page is small enough to collect
+  template <class CompletionToken>
+    auto async_search(query q, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(std::vector<message>, std::string)>(
+          [this](auto handler, query q) {
+            auto rows = std::make_shared<std::vector<message>>();
+            auto done = make_completion<std::vector<message>, std::string>(
+                std::move(handler), asio::system_executor{});
+
+            search(std::move(q),
+                [rows](const message& row) { rows->push_back(row); },
+                [rows, done](std::size_t, const std::string& error) { done(std::move(*rows), error); });
+          }, token, std::move(q));
+    }
+
+  template <class CompletionToken>
+    auto async_count(aggregate a, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(counts)>(
+          [this](auto handler, aggregate a) {
+            count(std::move(a), make_completion<counts>(std::move(handler), asio::system_executor{}));
+          }, token, std::move(a));
+    }
+
+  void stop();
+
+private:
+  void post(job j);
+  void run();
+  void execute(const query& q, const row_handler& on_row, const done_handler& on_done);
+  void execute(const aggregate& a, const count_handler& on_done);
+  void count_live(const aggregate& a, std::unordered_map<std::string, std::uint64_t>& totals, counts& result);
+  void count_archived(const aggregate& a, std::unordered_map<std::string, std::uint64_t>& totals, counts& result);
+};
+
+} // namespace database
+
+} // namespace dc
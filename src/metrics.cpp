@@ -0,0 +1,301 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+
+#include "log.hpp"
+
+namespace dc {
+
+namespace metrics {
+
+constexpr auto settings_fields = std::make_tuple(
+    optional("enabled", &settings::enabled),
+    optional("address", &settings::address),
+    optional("port", &settings::port));
+
+std::error_code decode(const json::value& jv, settings& s) {
+  return decode_object(jv, s, settings_fields);
+}
+
+std::size_t histogram::index(std::uint64_t value) {
+  if (value < sub_buckets)
+    return static_cast<std::size_t>(value);
+
+  auto exponent = 63 - __builtin_clzll(value);
+  auto sub = (value >> (exponent - 3)) & (sub_buckets - 1);
+  auto i = static_cast<std::size_t>(exponent - 2) * sub_buckets + sub;
+  return i < bucket_count ? i : bucket_count - 1;
+}
+
+std::uint64_t histogram::lower_bound(std::size_t index) {
+  if (index < sub_buckets)
+    return index;
+
+  auto exponent = index / sub_buckets + 2;
+  auto sub = index % sub_buckets;
+  return (sub_buckets + sub) << (exponent - 3);
+}
+
+std::uint64_t histogram::upper_bound(std::size_t index) {
+  if (index < sub_buckets)
+    return index + 1;
+
+  auto exponent = index / sub_buckets + 2;
+  return lower_bound(index) + (std::uint64_t{ 1 } << (exponent - 3));
+}
+
+void histogram::record(std::uint64_t value) {
+  buckets_[index(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  auto current = max_.load(std::memory_order_relaxed);
+  while (value > current && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    ;
+}
+
+std::uint64_t histogram::percentile(double p) const {
+  auto total = count();
+  if (!total)
+    return 0;
+
+  auto rank = static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(total) + 0.5);
+  rank = std::max<std::uint64_t>(rank, 1);
+
+  std::uint64_t seen{ 0 };
+  for (std::size_t i = 0; i < bucket_count; ++i) {
+    seen += bucket(i);
+    if (seen >= rank)
+      return std::min(upper_bound(i) - 1, max());
+  }
+
+  return max();
+}
+
+template <class T>
+T& registry::find_or_add(std::deque<entry<T>>& list, std::string_view name,
+    std::string_view help, std::string_view labels) {
+  std::lock_guard lock{ mutex };
+
+  for (auto& e: list) {
+    if (e.name == name && e.labels == labels)
+      return e.metric;
+  }
+
+  auto& e = list.emplace_back();
+  e.name = name;
+  e.help = help;
+  e.labels = labels;
+  return e.metric;
+}
+
+counter& registry::get_counter(std::string_view name, std::string_view help, std::string_view labels) {
+  return find_or_add(counters, name, help, labels);
+}
+
+gauge& registry::get_gauge(std::string_view name, std::string_view help, std::string_view labels) {
+  return find_or_add(gauges, name, help, labels);
+}
+
+histogram& registry::get_histogram(std::string_view name, std::string_view help, std::string_view labels) {
+  return find_or_add(histograms, name, help, labels);
+}
+
+namespace {
+
+  std::string with_labels(const std::string& labels, std::string_view extra = {}) {
+    if (labels.empty() && extra.empty())
+      return {};
+
+    std::string out{ "{" };
+    out += labels;
+    if (!labels.empty() && !extra.empty())
+      out += ',';
+    out += extra;
+    out += '}';
+    return out;
+  }
+
+  template <class Entries, class F>
+  void each_family(const Entries& list, F&& f) {
+    std::vector<const std::string*> seen;
+    for (const auto& e: list) {
+      if (std::find_if(seen.begin(), seen.end(), [&](auto n) { return *n == e.name; }) != seen.end())
+        continue;
+      seen.push_back(&e.name);
+      f(e.name, e.help);
+    }
+  }
+
+} // namespace
+
+void registry::write_prometheus(std::ostream& out) const {
+  std::lock_guard lock{ mutex };
+
+  each_family(counters, [&](const std::string& name, const std::string& help) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " counter\n";
+        for (const auto& e: counters) {
+          if (e.name == name)
+            out << name << with_labels(e.labels) << ' ' << e.metric.get() << '\n';
+        }
+      });
+
+  each_family(gauges, [&](const std::string& name, const std::string& help) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " gauge\n";
+        for (const auto& e: gauges) {
+          if (e.name == name)
+            out << name << with_labels(e.labels) << ' ' << e.metric.get() << '\n';
+        }
+      });
+
+  // Exposed with bounds of 2^n - 1, which line up with the edges of the
+  // finer buckets; those only feed the percentiles in the console summary
+  each_family(histograms, [&](const std::string& name, const std::string& help) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " histogram\n";
+        for (const auto& e: histograms) {
+          if (e.name != name)
+            continue;
+
+          const auto& h = e.metric;
+          std::uint64_t cumulative{ 0 };
+          std::size_t i{ 0 };
+
+          for (std::uint64_t bound = 1; bound && bound <= std::max<std::uint64_t>(h.max(), 1); bound <<= 1) {
+            for (; i < histogram::bucket_count && histogram::upper_bound(i) <= bound; ++i)
+              cumulative += h.bucket(i);
+
+            out << name << "_bucket" << with_labels(e.labels, "le=\"" + std::to_string(bound - 1) + '"')
+              << ' ' << cumulative << '\n';
+          }
+
+          out << name << "_bucket" << with_labels(e.labels, "le=\"+Inf\"") << ' ' << h.count() << '\n';
+          out << name << "_sum" << with_labels(e.labels) << ' ' << h.sum() << '\n';
+          out << name << "_count" << with_labels(e.labels) << ' ' << h.count() << '\n';
+        }
+      });
+}
+
+void registry::write_summary(std::ostream& out) const {
+  std::lock_guard lock{ mutex };
+
+  for (const auto& e: counters)
+    out << e.name << with_labels(e.labels) << ": " << e.metric.get() << '\n';
+
+  for (const auto& e: gauges)
+    out << e.name << with_labels(e.labels) << ": " << e.metric.get() << '\n';
+
+  for (const auto& e: histograms) {
+    const auto& h = e.metric;
+    out << e.name << with_labels(e.labels) << ": count " << h.count()
+      << ", p50 " << h.percentile(50)
+      << ", p99 " << h.percentile(99)
+      << ", max " << h.max() << '\n';
+  }
+}
+
+registry& global() {
+  static registry instance;
+  return instance;
+}
+
+namespace {
+
+  constexpr std::size_t max_request = 8 * 1024;
+  constexpr auto request_timeout = std::chrono::seconds(5);
+  constexpr auto accept_backoff = std::chrono::milliseconds(100);
+
+  bool out_of_resources(const std::error_code& error) {
+    return error == std::errc::too_many_files_open
+      || error == std::errc::too_many_files_open_in_system
+      || error == std::errc::no_buffer_space
+      || error == std::errc::not_enough_memory;
+  }
+
+} // namespace
+
+http_server::http_server(asio::io_context& io, const settings& settings, registry& metrics)
+  : acceptor(io, tcp::endpoint(asio::ip::make_address(settings.address), static_cast<unsigned short>(settings.port)))
+  , retry(acceptor.get_executor())
+  , metrics(metrics)
+{
+  log::info(log::subsystem::metrics, "Serving on ", settings.address, ':', settings.port);
+  start_accept();
+}
+
+void http_server::start_accept() {
+  // Each exchange runs on its own strand, shared by the socket and deadline
+  acceptor.async_accept(asio::make_strand(acceptor.get_executor()),
+      [this](const std::error_code& error, tcp::socket socket) {
+        if (error == asio::error::operation_aborted)
+          return;
+
+        if (error) {
+          log::error(log::subsystem::metrics, "Accept error: ", error.message());
+
+          // Accepting again straight away would spin until a descriptor frees up
+          if (!out_of_resources(error))
+            return start_accept();
+
+          retry.expires_after(accept_backoff);
+          retry.async_wait(
+              [this](const std::error_code& error) {
+                if (error != asio::error::operation_aborted)
+                  start_accept();
+              });
+          return;
+        }
+
+        // Requests past max_request bytes fail the read, and clients that
+        // take longer than the deadline are cut off
+        struct exchange {
+          explicit exchange(tcp::socket socket)
+            : socket(std::move(socket))
+            , request(max_request)
+            , deadline(this->socket.get_executor())
+          {}
+
+          tcp::socket socket;
+          asio::streambuf request;
+          asio::steady_timer deadline;
+          std::string response;
+        };
+
+        auto ex = std::make_shared<exchange>(std::move(socket));
+
+        ex->deadline.expires_after(request_timeout);
+        ex->deadline.async_wait(
+            [weak = std::weak_ptr<exchange>{ ex }](const std::error_code& error) {
+              auto ex = weak.lock();
+              if (error || !ex)
+                return;
+
+              std::error_code ignored;
+              ex->socket.close(ignored);
+            });
+
+        asio::async_read_until(ex->socket, ex->request, "\r\n\r\n",
+            [this, ex](const std::error_code& error, std::size_t) {
+              if (error)
+                return;
+
+              std::stringstream body;
+              metrics.write_prometheus(body);
+              auto text = body.str();
+
+              ex->response = "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(text.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + text;
+
+              // The socket closes once the last reference to the exchange goes
+              asio::async_write(ex->socket, asio::buffer(ex->response),
+                  [ex](const std::error_code&, std::size_t) {});
+            });
+
+        start_accept();
+      });
+}
+
+} // namespace metrics
+
+} // namespace dc
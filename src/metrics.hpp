@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#include "common.hpp"
+
+namespace dc {
+
+namespace metrics {
+
+struct settings {
+  bool enabled{ false };
+  std::string address{ "127.0.0.1" };
+  int port{ 9100 };
+};
+
+std::error_code decode(const json::value& jv, settings& s);
+
+class counter {
+  std::atomic<std::uint64_t> value_{ 0 };
+
+public:
+  void add(std::uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  std::uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+};
+
+class gauge {
+  std::atomic<std::int64_t> value_{ 0 };
+
+public:
+  void set(std::int64_t v) { value_.store(v, std::memory_order_relaxed); }
+  void add(std::int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  std::int64_t get() const { return value_.load(std::memory_order_relaxed); }
+};
+
+/*
+ * Log-linear histogram: every power of two is split into 8 linear buckets,
+ * so any recorded value is off by at most 12.5%. Recording is one relaxed
+ * increment; no locks and no allocation.
+ */
+class histogram {
+public:
+  static constexpr std::size_t sub_buckets = 8;
+  static constexpr std::size_t bucket_count = 62 * sub_buckets;
+
+private:
+  std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+  std::atomic<std::uint64_t> count_{ 0 };
+  std::atomic<std::uint64_t> sum_{ 0 };
+  std::atomic<std::uint64_t> max_{ 0 };
+
+public:
+  static std::size_t index(std::uint64_t value);
+  static std::uint64_t lower_bound(std::size_t index);
+  static std::uint64_t upper_bound(std::size_t index);
+
+  void record(std::uint64_t value);
+
+  template <class Rep, class Period>
+    void record(std::chrono::duration<Rep, Period> elapsed) {
+      auto count = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      record(static_cast<std::uint64_t>(count > 0 ? count : 0));
+    }
+
+  std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  std::uint64_t bucket(std::size_t index) const { return buckets_[index].load(std::memory_order_relaxed); }
+
+  std::uint64_t percentile(double p) const;
+};
+
+/*
+ * Owns every metric. Lookups take a lock and may allocate, so callers look
+ * their metrics up once and keep the reference; the same name and labels
+ * always give back the same metric.
+ */
+class registry {
+  template <class T>
+    struct entry {
+      std::string name;
+      std::string help;
+      std::string labels;
+      T metric;
+    };
+
+  mutable std::mutex mutex;
+  std::deque<entry<counter>> counters;
+  std::deque<entry<gauge>> gauges;
+  std::deque<entry<histogram>> histograms;
+
+  template <class T>
+    T& find_or_add(std::deque<entry<T>>& list, std::string_view name,
+        std::string_view help, std::string_view labels);
+
+public:
+  counter& get_counter(std::string_view name, std::string_view help, std::string_view labels = {});
+  gauge& get_gauge(std::string_view name, std::string_view help, std::string_view labels = {});
+  histogram& get_histogram(std::string_view name, std::string_view help, std::string_view labels = {});
+
+  // Prometheus text exposition format
+  void write_prometheus(std::ostream& out) const;
+  // One line per metric, for the console
+  void write_summary(std::ostream& out) const;
+};
+
+registry& global();
+
+using asio::ip::tcp;
+
+/*
+ * Bare HTTP/1.0 responder for Prometheus scrapes. Every request gets the
+ * current metrics and the connection is closed.
+ */
+class http_server {
+  tcp::acceptor acceptor;
+  // Backs off accepting while out of descriptors or memory
+  asio::steady_timer retry;
+  registry& metrics;
+
+public:
+  http_server(asio::io_context& io, const settings& settings, registry& metrics);
+
+private:
+  void start_accept();
+};
+
+} // namespace metrics
+
+} // namespace dc
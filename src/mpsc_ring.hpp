@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace dc {
+
+/*
+ * Bounded multi-producer, single-consumer queue over a ring of
+ * preallocated slots. Producers claim a slot with one CAS and fill it in
+ * place; a full ring fails the push instead of blocking or growing.
+ * Capacity is rounded up to a power of two.
+ */
+template <class T>
+class mpsc_ring {
+  struct alignas(64) slot {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  std::size_t mask;
+  std::unique_ptr<slot[]> slots;
+  alignas(64) std::atomic<std::size_t> head{ 0 };
+  alignas(64) std::atomic<std::size_t> tail{ 0 };
+
+public:
+  explicit mpsc_ring(std::size_t capacity) {
+    std::size_t size{ 1 };
+    while (size < capacity)
+      size <<= 1;
+
+    mask = size - 1;
+    slots = std::make_unique<slot[]>(size);
+    for (std::size_t i = 0; i < size; ++i)
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  mpsc_ring(const mpsc_ring&) = delete;
+  mpsc_ring& operator=(const mpsc_ring&) = delete;
+
+  std::size_t capacity() const { return mask + 1; }
+
+  // `fill(T&)` runs on the claimed slot before it is published
+  template <class F>
+    bool try_push(F&& fill) {
+      auto pos = head.load(std::memory_order_relaxed);
+      slot* s;
+
+      for (;;) {
+        s = &slots[pos & mask];
+        auto sequence = s->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+
+        if (diff == 0) {
+          if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = head.load(std::memory_order_relaxed);
+        }
+      }
+
+      fill(s->value);
+      s->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+  // Consumer only. `consume(T&)` runs before the slot is handed back
+  template <class F>
+    bool try_pop(F&& consume) {
+      auto pos = tail.load(std::memory_order_relaxed);
+      auto& s = slots[pos & mask];
+      if (s.sequence.load(std::memory_order_acquire) != pos + 1)
+        return false;
+
+      consume(s.value);
+      s.sequence.store(pos + mask + 1, std::memory_order_release);
+      tail.store(pos + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+  // Approximate from any thread other than the consumer
+  std::size_t size() const {
+    auto pushed = head.load(std::memory_order_relaxed);
+    auto popped = tail.load(std::memory_order_relaxed);
+    return pushed > popped ? pushed - popped : 0;
+  }
+};
+
+} // namespace dc
@@ -0,0 +1,162 @@
+#include "pool.hpp"
+
+#include <algorithm>
+
+#include "log.hpp"
+
+namespace dc {
+
+namespace twitch {
+
+pool::pool(asio::io_context& io, ssl::context& ctx, timer_service& timers, const settings& settings)
+  : timers(timers)
+  , settings_(settings)
+  , buckets(std::make_shared<rate_buckets>(settings.limits))
+{
+  auto count = static_cast<std::size_t>(std::max(1, settings_.connections));
+  assigned.resize(count);
+  state.resize(count, link::starting);
+  drops.resize(count, 0);
+
+  for (std::size_t i = 0; i < count; ++i) {
+    auto shard = settings_;
+    shard.channels.clear();
+
+    for (std::size_t c = i; c < settings_.channels.size(); c += count) {
+      shard.channels.push_back(settings_.channels[c]);
+      owner[settings_.channels[c]] = i;
+    }
+
+    assigned[i] = shard.channels;
+
+    clients.push_back(std::make_unique<client>(io, ctx, timers, shard, buckets));
+    clients.back()->set_state_handler(
+        [this, i](bool connected) {
+          on_state(i, connected);
+        });
+  }
+}
+
+void pool::say(std::string_view channel, std::string_view message) {
+  std::optional<std::size_t> index;
+  {
+    std::lock_guard lock{ mutex };
+    auto it = owner.find(std::string{ channel });
+    index = it != owner.end() ? std::make_optional(it->second) : least_loaded();
+  }
+
+  if (index)
+    clients[*index]->say(channel, message);
+}
+
+client& pool::owner_of(std::string_view channel) {
+  std::lock_guard lock{ mutex };
+  auto it = owner.find(std::string{ channel });
+  return *clients[it != owner.end() ? it->second : 0];
+}
+
+void pool::register_handler(const std::string& name, const client::message_handler& handler) {
+  for (auto& client: clients)
+    client->register_handler(name, handler);
+}
+
+void pool::set_read_gate(const client::read_gate& gate) {
+  for (auto& client: clients)
+    client->set_read_gate(gate);
+}
+
+void pool::on_state(std::size_t index, bool connected) {
+  std::lock_guard lock{ mutex };
+
+  log::info(log::subsystem::twitch, "Connection ", index, connected ? " up" : " down",
+      ", ", assigned[index].size(), " channels");
+
+  if (connected) {
+    auto returning = state[index] == link::gone;
+    state[index] = link::up;
+
+    // Only a connection that lost its channels has anything to take back
+    if (returning)
+      rebalance();
+    return;
+  }
+
+  // A connection that never came up keeps its channels; it is retrying
+  if (state[index] != link::up)
+    return;
+
+  state[index] = link::down;
+  auto drop = ++drops[index];
+
+  timers.schedule(down_grace,
+      [this, index, drop] {
+        on_grace_expired(index, drop);
+      });
+}
+
+void pool::on_grace_expired(std::size_t index, std::uint64_t drop) {
+  std::lock_guard lock{ mutex };
+
+  if (state[index] != link::down || drops[index] != drop)
+    return;
+
+  log::info(log::subsystem::twitch, "Connection ", index, " still down, moving ",
+      assigned[index].size(), " channels");
+
+  state[index] = link::gone;
+  rebalance();
+}
+
+void pool::move_channel(std::string channel, std::size_t to) {
+  auto& from = owner[channel];
+  if (from == to)
+    return;
+
+  auto& list = assigned[from];
+  list.erase(std::find(list.begin(), list.end(), channel));
+  assigned[to].push_back(channel);
+
+  clients[from]->remove_channel(channel);
+  clients[to]->add_channel(channel);
+  from = to;
+}
+
+std::optional<std::size_t> pool::least_loaded() const {
+  std::optional<std::size_t> best;
+
+  for (std::size_t i = 0; i < clients.size(); ++i) {
+    if (state[i] != link::up)
+      continue;
+
+    if (!best || assigned[i].size() < assigned[*best].size())
+      best = i;
+  }
+
+  return best;
+}
+
+void pool::rebalance() {
+  // Connections still starting or inside their grace period keep a share
+  auto gone = static_cast<std::size_t>(std::count(state.begin(), state.end(), link::gone));
+  auto holding = clients.size() - gone;
+  if (!holding)
+    return;
+
+  auto target = (owner.size() + holding - 1) / holding;
+
+  for (std::size_t i = 0; i < clients.size(); ++i) {
+    auto limit = state[i] != link::gone ? target : 0;
+
+    while (assigned[i].size() > limit) {
+      auto to = least_loaded();
+      if (!to || *to == i || assigned[*to].size() >= target)
+        break;
+
+      move_channel(assigned[i].back(), *to);
+    }
+  }
+}
+
+} // namespace twitch
+
+} // namespace dc
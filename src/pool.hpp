@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mutex>
+
+#include "twitch.hpp"
+
+namespace dc {
+
+namespace twitch {
+
+/*
+ * Spreads the configured channels across several client connections and
+ * presents them as one. Handlers are registered on every connection, and
+ * messages are sent through whichever connection owns the channel.
+ * Channels only move when a connection that was up stays down for longer
+ * than a grace period, so startup and quick reconnects cause no JOIN/PART
+ * churn.
+ */
+class pool {
+  enum class link { starting, up, down, gone };
+
+  static constexpr auto down_grace = std::chrono::seconds(30);
+
+  timer_service& timers;
+  settings settings_;
+  std::shared_ptr<rate_buckets> buckets;
+  std::vector<std::unique_ptr<client>> clients;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::size_t> owner;
+  std::vector<std::vector<std::string>> assigned;
+  std::vector<link> state;
+  // Bumped on every drop, so a stale grace timer can tell
+  std::vector<std::uint64_t> drops;
+
+public:
+  pool(asio::io_context& io, ssl::context& ctx, timer_service& timers, const settings& settings);
+
+  void say(std::string_view channel, std::string_view message);
+  void register_handler(const std::string& name, const client::message_handler& handler);
+  void set_read_gate(const client::read_gate& gate);
+
+  // Waits on the connection that owns `channel` right now
+  template <class CompletionToken>
+    auto async_next(std::string_view channel, std::string command,
+        client::message_filter filter, CompletionToken&& token) {
+      return owner_of(channel).async_next(std::move(command), std::move(filter),
+          std::forward<CompletionToken>(token));
+    }
+
+  const auto& get_settings() const { return settings_; }
+  std::size_t size() const { return clients.size(); }
+
+private:
+  client& owner_of(std::string_view channel);
+  void on_state(std::size_t index, bool connected);
+  void on_grace_expired(std::size_t index, std::uint64_t drop);
+  void move_channel(std::string channel, std::size_t to);
+  std::optional<std::size_t> least_loaded() const;
+  void rebalance();
+};
+
+} // namespace twitch
+
+} // namespace dc
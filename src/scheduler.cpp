@@ -0,0 +1,170 @@
+#include "scheduler.hpp"
+
+#include "log.hpp"
+
+namespace dc {
+
+namespace twitch {
+
+token_bucket::clock::time_point token_bucket::available_at(clock::time_point now) {
+  while (!spent.empty() && spent.front() + window <= now)
+    spent.pop_front();
+
+  if (spent.size() < capacity)
+    return now;
+
+  return spent[spent.size() - capacity] + window;
+}
+
+void token_bucket::take(clock::time_point now) {
+  spent.push_back(now);
+}
+
+scheduler::scheduler(const io_strand& strand, const rate_limits& limits, std::shared_ptr<rate_buckets> buckets, sink send)
+  : timer(strand)
+  , send(std::move(send))
+  , limits(limits)
+  , buckets(buckets ? std::move(buckets) : std::make_shared<rate_buckets>(limits))
+{}
+
+void scheduler::join(std::string_view line) {
+  joins.emplace_back(line);
+  pump();
+}
+
+void scheduler::chat(std::string_view channel, std::string_view line) {
+  auto [it, inserted] = channels.try_emplace(std::string{ channel });
+  auto& state = it->second;
+
+  for (const auto& queued: state.queue) {
+    if (queued.line == line)
+      return;
+  }
+
+  if (state.queue.size() >= max_channel_queue) {
+    log::warn(log::subsystem::twitch, "Dropping oldest queued message for ", channel);
+    state.queue.pop_front();
+  }
+
+  state.queue.push_back({ std::string{ line }, clock::now() });
+
+  if (!state.active) {
+    state.active = true;
+    active.push_back(it->first);
+  }
+
+  pump();
+}
+
+void scheduler::set_moderator(std::string_view channel, bool moderator) {
+  auto& state = channels[std::string{ channel }];
+  state.moderator = moderator;
+  update_channel_bucket(state);
+  pump();
+}
+
+void scheduler::set_slow_mode(std::string_view channel, std::chrono::seconds delay) {
+  auto& state = channels[std::string{ channel }];
+  state.slow_mode = delay;
+  update_channel_bucket(state);
+  pump();
+}
+
+std::size_t scheduler::queued() const {
+  std::size_t count = joins.size();
+  for (const auto& [name, state]: channels)
+    count += state.queue.size();
+  return count;
+}
+
+void scheduler::update_channel_bucket(channel_state& state) {
+  if (state.moderator)
+    state.bucket.set_window(clock::duration::zero());
+  else
+    state.bucket.set_window(std::max<clock::duration>(std::chrono::seconds(1), state.slow_mode));
+}
+
+void scheduler::pump() {
+  std::lock_guard lock{ buckets->mutex };
+
+  auto now = clock::now();
+  auto wake = clock::time_point::max();
+
+  while (!joins.empty()) {
+    auto at = buckets->join.available_at(now);
+    if (at > now) {
+      wake = at;
+      break;
+    }
+
+    buckets->join.take(now);
+    send(joins.front());
+    joins.pop_front();
+  }
+
+  std::size_t idle = 0;
+  while (!active.empty() && idle < active.size()) {
+    auto name = std::move(active.front());
+    active.pop_front();
+
+    auto& state = channels[name];
+
+    while (!state.queue.empty() && now - state.queue.front().queued > limits.max_age) {
+      log::warn(log::subsystem::twitch, "Dropping stale message for ", name);
+      state.queue.pop_front();
+    }
+
+    if (state.queue.empty()) {
+      state.active = false;
+      continue;
+    }
+
+    auto at = std::max(state.bucket.available_at(now), buckets->moderator.available_at(now));
+    if (!state.moderator)
+      at = std::max(at, buckets->user.available_at(now));
+
+    if (at > now) {
+      wake = std::min(wake, at);
+      active.push_back(std::move(name));
+      ++idle;
+      continue;
+    }
+
+    state.bucket.take(now);
+    buckets->moderator.take(now);
+    if (!state.moderator)
+      buckets->user.take(now);
+
+    send(state.queue.front().line);
+    state.queue.pop_front();
+    idle = 0;
+
+    if (state.queue.empty())
+      state.active = false;
+    else
+      active.push_back(std::move(name));
+  }
+
+  if (wake != clock::time_point::max())
+    arm(wake);
+}
+
+void scheduler::arm(clock::time_point when) {
+  if (armed && *armed <= when)
+    return;
+
+  armed = when;
+  timer.expires_at(when);
+  timer.async_wait(
+      [this](const auto& error) {
+        if (error)
+          return;
+
+        armed.reset();
+        pump();
+      });
+}
+
+} // namespace twitch
+
+} // namespace dc
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+
+#include "common.hpp"
+
+namespace dc {
+
+namespace twitch {
+
+/*
+ * Sliding window token bucket: every token spent becomes available again
+ * `window` after it was taken, so no window of that length ever sees more
+ * than `capacity` sends. A capacity of zero is taken as one.
+ */
+class token_bucket {
+public:
+  using clock = std::chrono::steady_clock;
+
+private:
+  std::size_t capacity;
+  clock::duration window;
+  std::deque<clock::time_point> spent;
+
+public:
+  token_bucket(std::size_t capacity, clock::duration window)
+    : capacity(std::max<std::size_t>(capacity, 1))
+    , window(window)
+  {}
+
+  void set_capacity(std::size_t capacity) { this->capacity = std::max<std::size_t>(capacity, 1); }
+  void set_window(clock::duration window) { this->window = window; }
+
+  clock::time_point available_at(clock::time_point now);
+  void take(clock::time_point now);
+};
+
+struct rate_limits {
+  std::size_t messages{ 20 };
+  std::size_t moderator_messages{ 100 };
+  std::size_t joins{ 20 };
+  std::chrono::seconds max_age{ 30 };
+};
+
+/*
+ * Account wide limits, shared by every connection logged in as the same
+ * user.
+ */
+struct rate_buckets {
+  std::mutex mutex;
+  token_bucket user;
+  token_bucket moderator;
+  token_bucket join;
+
+  explicit rate_buckets(const rate_limits& limits)
+    : user(limits.messages, std::chrono::seconds(30))
+    , moderator(limits.moderator_messages, std::chrono::seconds(30))
+    , join(limits.joins, std::chrono::seconds(10))
+  {}
+};
+
+/*
+ * Paces outbound chat and JOINs to stay within Twitch's rate limits.
+ * JOINs are sent before any queued chat; everything else written through
+ * client::send_line bypasses the scheduler entirely. Only used from the
+ * owning client's strand.
+ */
+class scheduler {
+public:
+  using clock = std::chrono::steady_clock;
+  using sink = std::function<void(std::string_view)>;
+
+private:
+  struct pending {
+    std::string line;
+    clock::time_point queued;
+  };
+
+  struct channel_state {
+    std::deque<pending> queue;
+    token_bucket bucket{ 1, std::chrono::seconds(1) };
+    std::chrono::seconds slow_mode{ 0 };
+    bool moderator{ false };
+    bool active{ false };
+  };
+
+  static constexpr std::size_t max_channel_queue = 32;
+
+  asio::steady_timer timer;
+  sink send;
+  rate_limits limits;
+  std::shared_ptr<rate_buckets> buckets;
+  std::deque<std::string> joins;
+  std::unordered_map<std::string, channel_state> channels;
+  std::deque<std::string> active;
+  std::optional<clock::time_point> armed;
+
+public:
+  scheduler(const io_strand& strand, const rate_limits& limits, std::shared_ptr<rate_buckets> buckets, sink send);
+
+  void join(std::string_view line);
+  // The next connection rejoins everything itself
+  void clear_joins() { joins.clear(); }
+  void chat(std::string_view channel, std::string_view line);
+
+  void set_moderator(std::string_view channel, bool moderator);
+  void set_slow_mode(std::string_view channel, std::chrono::seconds delay);
+
+  std::size_t queued() const;
+
+private:
+  void pump();
+  void arm(clock::time_point when);
+  void update_channel_bucket(channel_state& state);
+};
+
+} // namespace twitch
+
+} // namespace dc
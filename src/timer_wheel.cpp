@@ -0,0 +1,280 @@
+#include "timer_wheel.hpp"
+
+#include <atomic>
+
+namespace dc {
+
+timer_wheel::timer_wheel(asio::io_context& io, std::uint32_t id, std::size_t reserve)
+  : id(id)
+  , strand(io.get_executor())
+  , timer(strand)
+  , pending_total(metrics::global().get_gauge("dc_timers_pending", "Timers waiting on the timing wheels"))
+{
+  slots.fill(npos);
+  nodes.reserve(reserve);
+}
+
+std::uint64_t timer_wheel::to_tick(clock::time_point time) const {
+  return static_cast<std::uint64_t>((time - epoch) / tick);
+}
+
+std::uint32_t timer_wheel::allocate() {
+  if (free_list != npos) {
+    auto index = free_list;
+    free_list = nodes[index].next;
+    return index;
+  }
+
+  nodes.emplace_back();
+  return static_cast<std::uint32_t>(nodes.size() - 1);
+}
+
+void timer_wheel::release(std::uint32_t index) {
+  auto& n = nodes[index];
+  n.fn = nullptr;
+  n.generation++;
+  n.next = free_list;
+  free_list = index;
+}
+
+void timer_wheel::link(std::uint32_t index) {
+  auto& n = nodes[index];
+  auto delta = n.expires - current;
+
+  std::size_t level{ 0 };
+  while (level + 1 < levels && delta >= (std::uint64_t{ 1 } << ((level + 1) * slot_bits)))
+    ++level;
+
+  auto slot = level * slot_count + ((n.expires >> (level * slot_bits)) & (slot_count - 1));
+
+  n.slot = static_cast<std::uint16_t>(slot);
+  n.prev = npos;
+  n.next = slots[slot];
+  if (n.next != npos)
+    nodes[n.next].prev = index;
+  slots[slot] = index;
+  n.linked = true;
+}
+
+void timer_wheel::unlink(std::uint32_t index) {
+  auto& n = nodes[index];
+
+  if (n.prev != npos)
+    nodes[n.prev].next = n.next;
+  else
+    slots[n.slot] = n.next;
+
+  if (n.next != npos)
+    nodes[n.next].prev = n.prev;
+
+  n.linked = false;
+}
+
+timer_id timer_wheel::schedule(clock::duration delay, callback fn) {
+  auto now = clock::now();
+  timer_id result;
+  bool start{ false };
+
+  {
+    std::lock_guard lock{ mutex };
+
+    // An empty wheel has nothing to advance over; catch it up for free
+    auto now_tick = to_tick(now);
+    if (!pending)
+      current = std::max(current, now_tick);
+
+    auto index = allocate();
+    auto& n = nodes[index];
+    n.fn = std::move(fn);
+
+    // Round up so a timer never fires early. A sleeping wheel's current
+    // tick lags the clock, so count from now rather than from current.
+    auto ticks = static_cast<std::uint64_t>((delay + tick - clock::duration(1)) / tick);
+    n.expires = std::min(std::max(now_tick, current) + std::clamp<std::uint64_t>(ticks, 1, max_ticks),
+        current + max_ticks);
+    link(index);
+
+    pending++;
+    pending_total.add(1);
+
+    result = { id, index, n.generation };
+
+    if (!armed || n.expires < wake) {
+      start = armed = true;
+      wake = n.expires;
+    }
+  }
+
+  if (start)
+    asio::post(strand, [this] { arm(); });
+
+  return result;
+}
+
+bool timer_wheel::cancel(timer_id t) {
+  std::lock_guard lock{ mutex };
+
+  if (t.index >= nodes.size())
+    return false;
+
+  auto& n = nodes[t.index];
+  if (n.generation != t.generation || !n.linked)
+    return false;
+
+  unlink(t.index);
+  release(t.index);
+  pending--;
+  pending_total.add(-1);
+  return true;
+}
+
+std::size_t timer_wheel::size() {
+  std::lock_guard lock{ mutex };
+  return pending;
+}
+
+void timer_wheel::cascade(std::size_t level) {
+  auto slot = level * slot_count + ((current >> (level * slot_bits)) & (slot_count - 1));
+  auto index = slots[slot];
+  slots[slot] = npos;
+
+  while (index != npos) {
+    auto next = nodes[index].next;
+    link(index);
+    index = next;
+  }
+}
+
+std::uint64_t timer_wheel::next_expiry() const {
+  // The first non-empty slot of the lowest level holds the next timers due
+  auto next = current + slot_count;
+  for (std::uint64_t t = current + 1; t < next; ++t) {
+    if (slots[t & (slot_count - 1)] != npos) {
+      next = t;
+      break;
+    }
+  }
+
+  // A higher level slot only matters on the tick it is cascaded
+  for (std::size_t level = 1; level < levels; ++level) {
+    auto shift = level * slot_bits;
+    for (std::uint64_t k = 1; k <= slot_count; ++k) {
+      auto boundary = ((current >> shift) + k) << shift;
+      if (boundary >= next)
+        break;
+
+      if (slots[level * slot_count + ((boundary >> shift) & (slot_count - 1))] != npos) {
+        next = boundary;
+        break;
+      }
+    }
+  }
+
+  return next;
+}
+
+void timer_wheel::arm() {
+  clock::time_point next;
+  {
+    std::lock_guard lock{ mutex };
+    if (!pending) {
+      armed = false;
+      return;
+    }
+
+    wake = next_expiry();
+    next = epoch + wake * tick;
+  }
+
+  timer.expires_at(next);
+  timer.async_wait(
+      [this](const auto& error) {
+        if (error != asio::error::operation_aborted)
+          on_tick();
+      });
+}
+
+void timer_wheel::advance(std::uint64_t target) {
+  while (current < target && pending) {
+    // Nothing is due or cascaded on the ticks in between; skip over them
+    current = std::min(next_expiry(), target);
+
+    // Higher levels first, so their timers can land in the slots below
+    // before those are cascaded themselves
+    std::size_t top{ 0 };
+    while (top + 1 < levels && (current & ((std::uint64_t{ 1 } << ((top + 1) * slot_bits)) - 1)) == 0)
+      ++top;
+    for (auto level = top; level > 0; --level)
+      cascade(level);
+
+    auto slot = current & (slot_count - 1);
+    auto index = slots[slot];
+    slots[slot] = npos;
+
+    while (index != npos) {
+      auto& n = nodes[index];
+      auto next = n.next;
+      n.linked = false;
+      due.push_back(std::move(n.fn));
+      release(index);
+      pending--;
+      index = next;
+    }
+  }
+
+  if (!pending)
+    current = std::max(current, target);
+}
+
+void timer_wheel::on_tick() {
+  {
+    std::lock_guard lock{ mutex };
+    advance(to_tick(clock::now()));
+
+    if (!pending)
+      armed = false;
+  }
+
+  pending_total.add(-static_cast<std::int64_t>(due.size()));
+
+  for (auto& fn: due)
+    fn();
+  due.clear();
+
+  bool again;
+  {
+    std::lock_guard lock{ mutex };
+    again = armed;
+  }
+
+  if (again)
+    arm();
+}
+
+timer_service::timer_service(asio::io_context& io, std::size_t threads) {
+  for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i)
+    wheels.push_back(std::make_unique<timer_wheel>(io, static_cast<std::uint32_t>(i)));
+}
+
+timer_id timer_service::schedule(timer_wheel::clock::duration delay, timer_wheel::callback fn) {
+  static std::atomic<std::size_t> next_wheel{ 0 };
+  thread_local std::size_t wheel = next_wheel++;
+
+  return wheels[wheel % wheels.size()]->schedule(delay, std::move(fn));
+}
+
+bool timer_service::cancel(timer_id timer) {
+  if (timer.wheel >= wheels.size())
+    return false;
+
+  return wheels[timer.wheel]->cancel(timer);
+}
+
+std::size_t timer_service::size() {
+  std::size_t total{ 0 };
+  for (auto& wheel: wheels)
+    total += wheel->size();
+  return total;
+}
+
+} // namespace dc
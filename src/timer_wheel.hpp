@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+
+#include "common.hpp"
+#include "metrics.hpp"
+
+namespace dc {
+
+struct timer_id {
+  std::uint32_t wheel{ 0 };
+  std::uint32_t index{ 0 };
+  std::uint32_t generation{ 0 };
+};
+
+/*
+ * Hierarchical timing wheel: four levels of 256 slots at a 10ms tick,
+ * covering a little over a year. Timers sit in intrusive lists threaded
+ * through a pool of reusable nodes, so scheduling and cancelling are O(1)
+ * and a tick only touches the slot that is due, plus the occasional
+ * cascade of a higher level slot into the ones below. The wheel sleeps
+ * until the next non-empty slot or cascade instead of waking every tick.
+ *
+ * Callbacks run on the wheel's strand, outside its lock; anything that
+ * belongs on another strand has to be posted there.
+ */
+class timer_wheel {
+public:
+  using clock = std::chrono::steady_clock;
+  using callback = std::function<void()>;
+
+  static constexpr auto tick = std::chrono::milliseconds(10);
+  static constexpr std::size_t levels = 4;
+  static constexpr std::size_t slot_bits = 8;
+  static constexpr std::size_t slot_count = 1 << slot_bits;
+  static constexpr std::uint64_t max_ticks = (std::uint64_t{ 1 } << (levels * slot_bits)) - 1;
+
+private:
+  static constexpr std::uint32_t npos = ~std::uint32_t{ 0 };
+
+  struct node {
+    callback fn;
+    std::uint64_t expires{ 0 };
+    std::uint32_t prev{ npos };
+    std::uint32_t next{ npos };
+    std::uint32_t generation{ 0 };
+    std::uint16_t slot{ 0 };
+    bool linked{ false };
+  };
+
+  std::uint32_t id;
+  io_strand strand;
+  asio::steady_timer timer;
+
+  std::mutex mutex;
+  std::vector<node> nodes;
+  std::uint32_t free_list{ npos };
+  std::array<std::uint32_t, levels * slot_count> slots;
+  std::size_t pending{ 0 };
+  clock::time_point epoch{ clock::now() };
+  std::uint64_t current{ 0 };
+  // Tick the steady timer waits for while armed
+  std::uint64_t wake{ 0 };
+  bool armed{ false };
+
+  // Reused by every tick
+  std::vector<callback> due;
+
+  metrics::gauge& pending_total;
+
+public:
+  timer_wheel(asio::io_context& io, std::uint32_t id, std::size_t reserve = 1024);
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  timer_id schedule(clock::duration delay, callback fn);
+  // False if the timer already fired or was cancelled
+  bool cancel(timer_id timer);
+
+  std::size_t size();
+
+private:
+  std::uint64_t to_tick(clock::time_point time) const;
+  std::uint32_t allocate();
+  void release(std::uint32_t index);
+  void link(std::uint32_t index);
+  void unlink(std::uint32_t index);
+  void cascade(std::size_t level);
+  std::uint64_t next_expiry() const;
+  void advance(std::uint64_t target);
+  void arm();
+  void on_tick();
+};
+
+/*
+ * One timer wheel per io thread. Each thread schedules on a wheel of its
+ * own choosing, which keeps the wheels' locks mostly uncontended.
+ */
+class timer_service {
+  std::vector<std::unique_ptr<timer_wheel>> wheels;
+
+public:
+  timer_service(asio::io_context& io, std::size_t threads);
+
+  timer_id schedule(timer_wheel::clock::duration delay, timer_wheel::callback fn);
+  bool cancel(timer_id timer);
+
+  std::size_t size();
+};
+
+} // namespace dc
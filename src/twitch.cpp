@@ -1,5 +1,10 @@
 #include "twitch.hpp"
 
+#include <algorithm>
+#include <charconv>
+
+#include "log.hpp"
+
 using std::placeholders::_1;
 using std::placeholders::_2;
 
@@ -7,134 +12,372 @@ namespace dc {
 
 namespace twitch {
 
-settings tag_invoke(json::value_to_tag<settings>, const json::value& jv) {
-  settings s;
-  const json::object& obj = jv.as_object();
-  extract(obj, s.enabled, "enabled");
-  extract(obj, s.host, "host");
-  extract(obj, s.port, "port");
-  extract(obj, s.nick, "nick");
-  extract(obj, s.pass, "pass");
-  extract(obj, s.channels, "channels");
-  return s;
+constexpr auto settings_fields = std::make_tuple(
+    required("enabled", &settings::enabled),
+    required("host", &settings::host),
+    required("port", &settings::port),
+    required("nick", &settings::nick),
+    required("pass", &settings::pass),
+    required("channels", &settings::channels),
+    optional("connections", &settings::connections),
+    optional("reconnect_delay", &settings::reconnect_delay),
+    optional("max_reconnect_delay", &settings::max_reconnect_delay));
+
+// The limits sit next to the other keys rather than in their own object
+constexpr auto limits_fields = std::make_tuple(
+    optional("message_limit", &rate_limits::messages),
+    optional("moderator_message_limit", &rate_limits::moderator_messages),
+    optional("join_limit", &rate_limits::joins),
+    optional("max_message_age", &rate_limits::max_age));
+
+std::error_code decode(const json::value& jv, settings& s) {
+  if (auto ec = decode_object(jv, s, settings_fields))
+    return ec;
+
+  if (auto ec = decode_object(jv, s.limits, limits_fields))
+    return ec;
+
+  // A bucket that holds nothing could never send
+  if (!s.limits.messages || !s.limits.moderator_messages || !s.limits.joins)
+    return make_error_code(decode_error::out_of_range);
+
+  return {};
 }
 
-client::client(asio::io_context& io, ssl::context& ctx, const settings& settings)
+client::client(asio::io_context& io, ssl::context& ctx, timer_service& timers,
+    const settings& settings, std::shared_ptr<rate_buckets> buckets)
   : io(io)
   , ctx(ctx)
+  , timers(timers)
   , settings_(settings)
-  , socket(io, ctx)
+  , strand(io.get_executor())
+  , resolver(strand)
+  , jitter(std::random_device{}())
+  , outbound(strand, settings_.limits, std::move(buckets), [this](std::string_view line) { write_scheduled(line); })
+  , channels_(settings_.channels)
+  , lines_read(metrics::global().get_counter("dc_twitch_lines_read_total", "IRC lines received"))
+  , bytes_read(metrics::global().get_counter("dc_twitch_read_bytes_total", "Bytes read from Twitch"))
+  , bytes_written(metrics::global().get_counter("dc_twitch_written_bytes_total", "Bytes written to Twitch"))
+  , queued_lines(metrics::global().get_gauge("dc_twitch_write_queue_lines", "Lines waiting to be written"))
+  , dispatch_time(metrics::global().get_histogram("dc_twitch_dispatch_nanoseconds", "Time spent in message handlers per line"))
+  , reconnects(metrics::global().get_counter("dc_twitch_reconnects_total", "Reconnect attempts after a failure"))
+  , connections_up(metrics::global().get_gauge("dc_twitch_connections_up", "Registered IRC connections"))
+  , recovery_time(metrics::global().get_histogram("dc_twitch_recovery_nanoseconds", "Time from losing a connection to registering again"))
+  , read_pauses(metrics::global().get_counter("dc_twitch_read_pauses_total", "Reads held back by a full event bus"))
 {
-  socket.set_verify_mode(ssl::verify_peer);
-  socket.set_verify_callback(std::bind(&client::verify_certificate, this, _1, _2));
 
   register_handler(
     "PING",
-    [this](auto, auto, std::string_view ping) {
+    [this](const irc::message& ping) {
       std::stringstream pong;
-      pong << "PONG :" << ping;
-      send_line(pong.str());
-      std::cout << "> PONG\n";
+      pong << "PONG :" << ping.trailing();
+      write_line(pong.str());
+      log::debug(log::subsystem::twitch, "> PONG");
+    }
+  );
+
+  register_handler(
+    "001",
+    [this](const irc::message&) {
+      state_ = state::connected;
+      failures = 0;
+
+      if (down_since) {
+        recovery_time.record(clock::now() - *down_since);
+        down_since.reset();
+      }
+
+      // Joins go through the scheduler, which paces them to the join limit
+      for (const auto& channel: channels_)
+        join(channel);
+
+      // The scheduler sends JOINs ahead of chat, so held lines follow the rejoins
+      for (auto& line: std::exchange(replay, {})) {
+        auto channel = line.substr(8, line.find(' ', 8) - 8);
+        outbound.chat(channel, line);
+      }
+
+      set_connected(true);
+    }
+  );
+
+  register_handler(
+    "ROOMSTATE",
+    [this](const irc::message& msg) {
+      auto slow = msg.raw_tag("slow");
+      if (!slow)
+        return;
+
+      int seconds = 0;
+      std::from_chars(slow->data(), slow->data() + slow->size(), seconds);
+      outbound.set_slow_mode(msg.param(0), std::chrono::seconds(seconds));
+    }
+  );
+
+  register_handler(
+    "USERSTATE",
+    [this](const irc::message& msg) {
+      auto badges = msg.raw_tag("badges").value_or("");
+      bool moderator = msg.raw_tag("mod") == std::string_view{ "1" }
+        || badges.find("broadcaster/") != std::string_view::npos;
+
+      outbound.set_moderator(msg.param(0), moderator);
     }
   );
 
   if (settings_.enabled)
-    connect();
+    asio::post(strand, [this] { connect(); });
 }
 
 void client::join(std::string_view channel) {
   std::stringstream msg;
   msg << "JOIN " << channel;
+  log::debug(log::subsystem::twitch, "> ", msg.str());
+
+  asio::dispatch(strand,
+      [this, line = msg.str()] {
+        outbound.join(line);
+      });
+}
+
+void client::part(std::string_view channel) {
+  std::stringstream msg;
+  msg << "PART " << channel;
+  log::debug(log::subsystem::twitch, "> ", msg.str());
+
   send_line(msg.str());
-  std::cout << "> " << msg.str() << '\n';
 }
 
 void client::say(std::string_view receiver, std::string_view message) {
   std::stringstream msg;
   msg << "PRIVMSG " << receiver << " :" << message;
-  send_line(msg.str());
-  std::cout << "> " << msg.str() << '\n';
+  log::debug(log::subsystem::twitch, "> ", msg.str());
+
+  asio::dispatch(strand,
+      [this, channel = std::string{ receiver }, line = msg.str()] {
+        outbound.chat(channel, line);
+      });
+}
+
+void client::send_line(std::string_view data) {
+  asio::dispatch(strand,
+      [this, line = std::string{ data }] {
+        write_line(line);
+      });
+}
+
+void client::write_line(std::string_view data) {
+  to_write.push(data, "\r\n");
+  report_queue();
+
+  send_raw();
+}
+
+void client::write_scheduled(std::string_view data) {
+  // JOINs are redone after 001; chat waits for it
+  if (state_ != state::connected) {
+    if (data.starts_with("PRIVMSG "))
+      hold(data);
+    return;
+  }
+
+  write_line(data);
 }
 
-void client::send_line(std::string data) {
-  data += "\r\n";
-  to_write.push_back(std::move(data));
+void client::hold(std::string_view line) {
+  static constexpr std::size_t max_replay = 256;
+
+  if (replay.size() >= max_replay) {
+    log::warn(log::subsystem::twitch, "Dropping oldest held message");
+    replay.pop_front();
+  }
 
-  if (to_write.size() == 1)
-    send_raw();
+  replay.emplace_back(line);
+}
+
+void client::report_queue() {
+  auto size = to_write.size();
+  queued_lines.add(static_cast<std::int64_t>(size) - static_cast<std::int64_t>(queued_reported));
+  queued_reported = size;
 }
 
 void client::register_handler(std::string name, message_handler handler) {
-  handlers[std::move(name)].push_back(handler);
+  asio::post(strand,
+      [this, name = std::move(name), handler = std::move(handler)] {
+        handlers[name].push_back(handler);
+      });
 }
 
-void client::connect() {
-  //socket.shutdown();
-  tcp::resolver resolver{ io };
+void client::add_channel(std::string channel) {
+  asio::dispatch(strand,
+      [this, channel = std::move(channel)] {
+        if (std::find(channels_.begin(), channels_.end(), channel) != channels_.end())
+          return;
 
-  auto handler = [this](auto&&... params) {
-    on_hostname_resolved(std::forward<decltype(params)>(params)...);
-  };
+        if (connected_)
+          join(channel);
 
-  resolver.async_resolve(settings_.host, std::to_string(settings_.port), handler);
+        channels_.push_back(channel);
+      });
 }
 
-void client::identify() {
-  std::stringstream msg;
-  msg << "PASS " << settings_.pass;
-  send_line(msg.str());
-  std::cout << "> PASS ********\n";
+void client::remove_channel(std::string_view channel) {
+  asio::dispatch(strand,
+      [this, channel = std::string{ channel }] {
+        auto it = std::find(channels_.begin(), channels_.end(), channel);
+        if (it == channels_.end())
+          return;
 
-  msg.str("");
-  msg << "NICK " << settings_.nick;
-  send_line(msg.str());
-  std::cout << "> " << msg.str() << '\n';
+        if (connected_)
+          part(channel);
+
+        channels_.erase(it);
+      });
 }
 
-void client::on_hostname_resolved(const std::error_code& error, tcp::resolver::results_type results) {
-  if (error) {
-    connect();
+void client::set_connected(bool connected) {
+  if (connected_ == connected)
+    return;
+
+  connected_ = connected;
+  connections_up.add(connected ? 1 : -1);
+
+  if (on_state)
+    on_state(connected);
+}
+
+void client::reconnect(std::string_view reason, const std::error_code& error) {
+  if (state_ == state::waiting)
     return;
+
+  if (error)
+    log::error(log::subsystem::twitch, reason, ": ", error.message());
+  else
+    log::error(log::subsystem::twitch, reason);
+
+  // Abandon the attempt; its pending completions see a stale attempt
+  ++attempt;
+  if (socket) {
+    std::error_code ignored;
+    socket->lowest_layer().close(ignored);
   }
 
-  if (!results.size()) {
-    std::stringstream msg;
-    msg << "Failed to resolve '" << settings_.host << "'";
-    throw std::runtime_error(msg.str());
+  // A write still in flight is settled by its completion, which reports
+  // how much of it the old socket took
+  outbound.clear_joins();
+
+  state_ = state::waiting;
+  set_connected(false);
+  if (!down_since)
+    down_since = clock::now();
+
+  auto ceiling = settings_.reconnect_delay * (1 << std::min(failures, 16));
+  ceiling = std::min(ceiling, settings_.max_reconnect_delay);
+  failures++;
+
+  // Equal jitter: at least half the ceiling, so retries never bunch at zero
+  std::uniform_int_distribution<std::int64_t> spread(ceiling.count() / 2, ceiling.count());
+  auto delay = std::chrono::milliseconds(spread(jitter));
+
+  reconnects.add();
+  log::info(log::subsystem::twitch, "Reconnecting in ", delay.count(), "ms, attempt ", failures);
+
+  timers.schedule(delay,
+      [this] {
+        asio::post(strand, [this] { connect(); });
+      });
+}
+
+void client::connect() {
+  state_ = state::connecting;
+  auto current = ++attempt;
+
+  socket = std::make_shared<ssl_socket>(strand, ctx);
+  socket->set_verify_mode(ssl::verify_peer);
+  socket->set_verify_callback(std::bind(&client::verify_certificate, this, _1, _2));
+
+  resolver.async_resolve(settings_.host, std::to_string(settings_.port),
+      [this, current](const auto& error, tcp::resolver::results_type results) {
+        if (current != attempt)
+          return;
+
+        if (error)
+          reconnect("Resolve failed", error);
+        else
+          on_hostname_resolved(std::move(results));
+      });
+}
+
+void client::identify() {
+  // Only if the old write's completion never arrived; its lines count as unsent
+  if (to_write.writing()) {
+    to_write.abort(0);
+    write_attempt = 0;
   }
 
-  asio::async_connect(socket.lowest_layer(), results,
-      [this](const auto& error, const tcp::endpoint& /* endpoint */) {
-        on_connected(error);
-      }
-  );
+  // Registration, PONGs, JOINs and PARTs belong to the old connection; the
+  // 001 handler rejoins through the scheduler. Chat is held until then.
+  to_write.retain(
+      [this](std::string_view line) {
+        if (line.starts_with("PRIVMSG "))
+          hold(line.substr(0, line.size() - 2));
+        return false;
+      });
+
+  // Ahead of anything queued while disconnected
+  std::stringstream msg;
+  msg << "NICK " << settings_.nick;
+  to_write.push_front(msg.str(), "\r\n");
+  log::debug(log::subsystem::twitch, "> ", msg.str());
+
+  msg.str("");
+  msg << "PASS " << settings_.pass;
+  to_write.push_front(msg.str(), "\r\n");
+  log::debug(log::subsystem::twitch, "> PASS ********");
+
+  to_write.push_front("CAP REQ :twitch.tv/tags twitch.tv/commands", "\r\n");
+  report_queue();
+
+  send_raw();
 }
 
-void client::on_connected(const std::error_code& error) {
-  if (error) {
-    std::cerr << "[Twitch] Connect error: " << error.message() << '\n';
-    connect();
+void client::on_hostname_resolved(tcp::resolver::results_type results) {
+  if (!results.size()) {
+    reconnect("No addresses for " + settings_.host);
     return;
   }
 
-  std::cout << "Connected.\n";
+  asio::async_connect(socket->lowest_layer(), results,
+      [this, current = attempt, s = socket](const auto& error, const tcp::endpoint& /* endpoint */) {
+        if (current != attempt)
+          return;
+
+        if (error) {
+          reconnect("Connect error", error);
+          return;
+        }
 
-  socket.async_handshake(ssl::stream_base::client,
-      [this](const auto& error) {
-        on_handshake(error);
+        log::info(log::subsystem::twitch, "Connected");
+
+        socket->async_handshake(ssl::stream_base::client,
+            [this, current, s](const auto& error) {
+              if (current != attempt)
+                return;
+
+              if (error)
+                reconnect("Handshake failed", error);
+              else
+                on_handshake();
+            });
       }
   );
 }
 
-void client::on_handshake(const std::error_code& error) {
-  if (error) {
-    std::cerr << "[Twitch] Handshake failed: " << error.message() << '\n';
-    connect();
-    return;
-  }
+void client::on_handshake() {
+  state_ = state::registering;
 
+  in_buf.clear();
   identify();
-
   await_new_line();
 }
 
@@ -142,77 +385,129 @@ bool client::verify_certificate(bool preverified, ssl::verify_context& ctx) {
   std::string subject(256, '\0');
   X509* cert = X509_STORE_CTX_get_current_cert(ctx.native_handle());
   X509_NAME_oneline(X509_get_subject_name(cert), &subject[0], 256);
-  std::cout << "Verifying " << subject << '\n';
+  log::debug(log::subsystem::twitch, "Verifying ", subject.c_str());
 
   return preverified;
 }
 
 void client::await_new_line() {
-  auto handler = [this](const auto& error, std::size_t s) {
+  // Leave the bytes in the socket until the bus has drained; the server
+  // sees a slow reader instead of us queueing without bound
+  if (paused && paused()) {
+    read_pauses.add();
+    timers.schedule(std::chrono::milliseconds(10),
+        [this, current = attempt] {
+          asio::post(strand,
+              [this, current] {
+                if (current == attempt)
+                  await_new_line();
+              });
+        });
+    return;
+  }
+
+  auto handler = [this, current = attempt, s = socket](const auto& error, std::size_t bytes_read) {
+    if (current != attempt)
+      return;
+
     if (error) {
-      std::cerr << "[Twitch] Read error: " << error.message() << '\n';
-      connect();
+      reconnect("Read error", error);
       return;
     }
 
-    std::istream istrm{ &in_buf };
-    std::string line;
-    std::getline(istrm, line);
+    in_buf.commit(bytes_read);
+    this->bytes_read.add(bytes_read);
+
+    while (auto line = in_buf.next_line())
+      on_new_line(*line);
 
-    on_new_line(line);
     await_new_line();
   };
 
-  asio::async_read_until(socket, in_buf, "\r\n", handler);
-}
+  asio::mutable_buffer buffer;
+  try {
+    buffer = in_buf.prepare();
+  } catch (const std::length_error& e) {
+    log::warn(log::subsystem::twitch, e.what(), ", discarding buffered input");
+    in_buf.clear();
+    buffer = in_buf.prepare();
+  }
 
-void client::on_new_line(const std::string& line) {
-  std::cout << "< " << line << '\n';
+  socket->async_read_some(buffer, handler);
+}
 
-  static auto constexpr server_message =
-    R"((?::([^@!\ ]*(?:(?:![^@]*)?@[^\ ]*)?)\ ))"
-    R"(?([^\ ]+)((?:[^:\ ][^\ ]*)?(?:\ [^:\ ][^\ ]*))"
-    R"({0,14})(?:\ :?(.*))?)";
+void client::on_new_line(std::string_view line) {
+  log::trace(log::subsystem::twitch, "< ", line);
+  lines_read.add();
 
-  std::string who, type, where, message;
-  extract_regex_groups(line.c_str(), std::regex{ server_message }, std::tie(who, type, where, message));
+  irc::message msg;
+  if (!irc::parse(line, msg)) {
+    log::warn(log::subsystem::twitch, "Malformed line: ", line);
+    return;
+  }
 
-  handle_message(who, type, where, message);
+  auto start = std::chrono::steady_clock::now();
+  handle_message(msg);
+  dispatch_time.record(std::chrono::steady_clock::now() - start);
 }
 
-void client::handle_message(std::string_view who, const std::string& type, std::string_view where, std::string_view message) {
-  for (const auto& handler: handlers[type]) {
-    handler(who, where, message);
+void client::handle_message(const irc::message& msg) {
+  if (auto it = handlers.find(msg.command); it != handlers.end()) {
+    for (const auto& handler: it->second) {
+      handler(msg);
+    }
+  }
+
+  auto it = waiters.find(msg.command);
+  if (it == waiters.end())
+    return;
+
+  auto& waiting = it->second;
+  for (auto w = waiting.begin(); w != waiting.end();) {
+    if (!w->first || w->first(msg)) {
+      w->second(irc::owned_message{ msg });
+      w = waiting.erase(w);
+    } else {
+      ++w;
+    }
   }
 }
 
 void client::send_raw() {
-  if (to_write.empty())
+  // Held back until the next connection has sent PASS/NICK
+  if (state_ != state::registering && state_ != state::connected)
+    return;
+
+  if (to_write.empty() || to_write.writing())
     return;
 
-  asio::async_write(socket, asio::buffer(to_write.front().data(), to_write.front().size()),
-    [this](auto&&... params) {
-      handle_write(params...);
+  write_attempt = attempt;
+  asio::async_write(*socket, to_write.prepare(),
+    [this, current = attempt, s = socket](const auto& error, std::size_t bytes_written) {
+      if (current == attempt) {
+        handle_write(error, bytes_written);
+      } else if (current == write_attempt) {
+        // Dropped by reconnect(); lines the old socket took are not sent again
+        to_write.abort(bytes_written);
+        report_queue();
+      }
     }
   );
 }
 
-void client::handle_write(const std::error_code& error, std::size_t bytes_read) {
+void client::handle_write(const std::error_code& error, std::size_t bytes_written) {
   if (error) {
-    std::cerr << "[Twitch] Write error: " << error << '\n';
+    this->bytes_written.add(bytes_written);
+    to_write.abort(bytes_written);
+    reconnect("Write error", error);
     return;
   }
 
-  auto to_erase = std::min(bytes_read, to_write.front().size());
-  auto& buf = to_write.front();
-
-  buf.erase(buf.begin(), buf.begin() + to_erase);
-
-  if (buf.empty())
-    to_write.erase(to_write.begin());
+  this->bytes_written.add(bytes_written);
+  to_write.consume();
+  report_queue();
 
-  if (!to_write.empty())
-    send_raw();
+  send_raw();
 }
 
 } // namespace twitch
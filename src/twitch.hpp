@@ -1,38 +1,16 @@
 #pragma once
 
-#include "common.hpp"
-
-namespace detail {
-
-template <typename Tuple, size_t... Is>
-void assign_regex_matches(Tuple&& tup, const std::cmatch& match, std::index_sequence<Is...>) {
-  using tuple_t = std::decay_t<Tuple>;
-  (
-  (void) (
-    std::get<Is>(tup) =
-      boost::lexical_cast<
-        std::decay_t<
-          std::tuple_element_t<Is, tuple_t>
-        >
-      >(match[1 + Is])
-  ), ...
-  );
-}
-
-}
-
-template <typename Tuple>
-void extract_regex_groups(const char* string, const std::regex& regex, Tuple&& tuple) {
-  constexpr auto size = std::tuple_size<Tuple>{}();
-
-  std::cmatch match;
-  std::regex_search(string, match, regex);
+#include <atomic>
+#include <random>
 
-  if (match.size() != size + 1)
-    throw std::runtime_error("Wrong number of captures");
-
-  detail::assign_regex_matches(std::forward<Tuple>(tuple), match, std::make_index_sequence<size>{});
-}
+#include "async.hpp"
+#include "common.hpp"
+#include "irc.hpp"
+#include "line_buffer.hpp"
+#include "metrics.hpp"
+#include "scheduler.hpp"
+#include "timer_wheel.hpp"
+#include "write_queue.hpp"
 
 namespace dc {
 
@@ -45,51 +23,132 @@ struct settings {
   std::string nick;
   std::string pass;
   std::vector<std::string> channels;
+  rate_limits limits;
+  int connections{ 1 };
+  std::chrono::milliseconds reconnect_delay{ 1000 };
+  std::chrono::milliseconds max_reconnect_delay{ 60000 };
 };
 
-settings tag_invoke(json::value_to_tag<settings>, const json::value& jv);
+std::error_code decode(const json::value& jv, settings& s);
 
+/*
+ * One IRC connection. Every failure closes the socket and waits out a
+ * capped exponential backoff with jitter before the next attempt, which
+ * starts over with a fresh TLS stream. Chat that never made it out is
+ * held and fed back through the scheduler once the new connection has
+ * registered and rejoined its channels.
+ */
 class client {
   using tcp = asio::ip::tcp;
+  using clock = std::chrono::steady_clock;
+
+  enum class state {
+    idle,
+    connecting,
+    registering,
+    connected,
+    waiting,
+  };
 
 public:
-  using message_handler = std::function<void(std::string_view, std::string_view, std::string_view)>;
+  using message_handler = std::function<void(const irc::message&)>;
   using ssl_socket = ssl::stream<tcp::socket>;
+  using state_handler = std::function<void(bool connected)>;
+  // Returns true while reading should pause, e.g. a full event bus
+  using read_gate = std::function<bool()>;
+  using message_filter = std::function<bool(const irc::message&)>;
 
 private:
   asio::io_context& io;
   ssl::context& ctx;
+  timer_service& timers;
   settings settings_;
-  //tcp::socket socket;
-  ssl_socket socket;
-  asio::streambuf in_buf;
-  std::unordered_map<std::string, std::vector<message_handler>> handlers;
-  std::deque<std::string> to_write;
+  io_strand strand;
+  tcp::resolver resolver;
+  std::shared_ptr<ssl_socket> socket;
+  state state_{ state::idle };
+  // Bumped per attempt; completions from an older attempt are ignored
+  std::uint64_t attempt{ 0 };
+  // Attempt of the write in flight, so a dropped one can still be settled
+  std::uint64_t write_attempt{ 0 };
+  int failures{ 0 };
+  std::optional<clock::time_point> down_since;
+  std::minstd_rand jitter;
+  line_buffer in_buf;
+  string_map<std::vector<message_handler>> handlers;
+  // One-shot, from async_next
+  string_map<std::vector<std::pair<message_filter, std::function<void(irc::owned_message)>>>> waiters;
+  write_queue to_write;
+  scheduler outbound;
+  // PRIVMSG lines held for the next 001
+  std::deque<std::string> replay;
+  std::vector<std::string> channels_;
+  std::atomic<bool> connected_{ false };
+  state_handler on_state;
+  read_gate paused;
+
+  // Shared by every connection; the queue gauge gets this client's share
+  metrics::counter& lines_read;
+  metrics::counter& bytes_read;
+  metrics::counter& bytes_written;
+  metrics::gauge& queued_lines;
+  metrics::histogram& dispatch_time;
+  std::size_t queued_reported{ 0 };
+  metrics::counter& reconnects;
+  metrics::gauge& connections_up;
+  metrics::histogram& recovery_time;
+  metrics::counter& read_pauses;
 
 public:
-  client(asio::io_context& io, ssl::context& ctx, const settings& settings);
+  client(asio::io_context& io, ssl::context& ctx, timer_service& timers,
+      const settings& settings, std::shared_ptr<rate_buckets> buckets = nullptr);
 
   void join(std::string_view channel);
+  void part(std::string_view channel);
   void say(std::string_view receiver, std::string_view message);
 
-  void send_line(std::string data);
+  void send_line(std::string_view data);
   void register_handler(std::string name, message_handler handler);
 
+  // Completes with the next `command` message passing `filter`, if given
+  template <class CompletionToken>
+    auto async_next(std::string command, message_filter filter, CompletionToken&& token) {
+      return asio::async_initiate<CompletionToken, void(irc::owned_message)>(
+          [this](auto handler, std::string command, message_filter filter) {
+            auto done = make_completion<irc::owned_message>(std::move(handler), strand);
+            asio::post(strand,
+                [this, command = std::move(command), filter = std::move(filter), done = std::move(done)] {
+                  waiters[command].emplace_back(filter, done);
+                });
+          }, token, std::move(command), std::move(filter));
+    }
+
+  void add_channel(std::string channel);
+  void remove_channel(std::string_view channel);
+  void set_state_handler(state_handler handler) { on_state = std::move(handler); }
+  void set_read_gate(read_gate gate) { paused = std::move(gate); }
+
   const auto& get_settings() const { return settings_; }
+  bool connected() const { return connected_; }
 
 private:
   void connect();
+  void reconnect(std::string_view reason, const std::error_code& error = {});
   void identify();
-
-  void on_hostname_resolved(const std::error_code& error, tcp::resolver::results_type results);
-  void on_connected(const std::error_code& error);
-  void on_handshake(const std::error_code& error);
+  void set_connected(bool connected);
+  void write_line(std::string_view data);
+  void write_scheduled(std::string_view data);
+  void hold(std::string_view line);
+  void report_queue();
+
+  void on_hostname_resolved(tcp::resolver::results_type results);
+  void on_handshake();
   bool verify_certificate(bool preverified, ssl::verify_context& ctx);
   void await_new_line();
-  void on_new_line(const std::string& line);
-  void handle_message(std::string_view who, const std::string& type, std::string_view where, std::string_view message);
+  void on_new_line(std::string_view line);
+  void handle_message(const irc::message& msg);
   void send_raw();
-  void handle_write(const std::error_code& error, std::size_t bytes_read);
+  void handle_write(const std::error_code& error, std::size_t bytes_written);
 };
 
 } // namespace twitch
@@ -0,0 +1,95 @@
+#include "write_queue.hpp"
+
+namespace dc {
+
+namespace {
+
+constexpr std::size_t max_spare = 64;
+constexpr std::size_t max_spare_capacity = 4096;
+
+} // namespace
+
+std::string write_queue::make_buffer(std::string_view data, std::string_view terminator) {
+  std::string buffer;
+  if (!spare.empty()) {
+    buffer = std::move(spare.back());
+    spare.pop_back();
+  }
+
+  buffer.assign(data);
+  buffer.append(terminator);
+  return buffer;
+}
+
+void write_queue::push(std::string_view data, std::string_view terminator) {
+  pending.push_back(make_buffer(data, terminator));
+}
+
+void write_queue::push_front(std::string_view data, std::string_view terminator) {
+  pending.push_front(make_buffer(data, terminator));
+}
+
+const std::vector<asio::const_buffer>& write_queue::prepare() {
+  buffers.clear();
+
+  std::size_t bytes = 0;
+  for (const auto& buffer: pending) {
+    if (!buffers.empty() && bytes + buffer.size() > max_bytes)
+      break;
+
+    buffers.push_back(asio::buffer(buffer));
+    bytes += buffer.size();
+  }
+
+  in_flight = buffers.size();
+  return buffers;
+}
+
+void write_queue::recycle(std::string buffer) {
+  if (spare.size() < max_spare && buffer.capacity() <= max_spare_capacity) {
+    buffer.clear();
+    spare.push_back(std::move(buffer));
+  }
+}
+
+void write_queue::consume() {
+  for (; in_flight > 0; --in_flight) {
+    recycle(std::move(pending.front()));
+    pending.pop_front();
+  }
+
+  buffers.clear();
+}
+
+void write_queue::abort(std::size_t written) {
+  // A buffer cut off part way is kept whole; the peer never saw it complete
+  for (; in_flight > 0 && pending.front().size() <= written; --in_flight) {
+    written -= pending.front().size();
+    recycle(std::move(pending.front()));
+    pending.pop_front();
+  }
+
+  in_flight = 0;
+  buffers.clear();
+}
+
+void write_queue::retain(const std::function<bool(std::string_view)>& keep) {
+  std::deque<std::string> kept;
+
+  for (auto& buffer: pending) {
+    if (keep(buffer))
+      kept.push_back(std::move(buffer));
+    else
+      recycle(std::move(buffer));
+  }
+
+  pending.swap(kept);
+}
+
+void write_queue::clear() {
+  pending.clear();
+  buffers.clear();
+  in_flight = 0;
+}
+
+} // namespace dc
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+#include "common.hpp"
+
+namespace dc {
+
+/*
+ * Outbound queue that hands every pending buffer, up to max_bytes, to a
+ * single gathered write. Buffers are recycled after they have been written
+ * instead of being freed.
+ */
+class write_queue {
+  std::deque<std::string> pending;
+  std::vector<std::string> spare;
+  std::vector<asio::const_buffer> buffers;
+  std::size_t in_flight{ 0 };
+  std::size_t max_bytes;
+
+public:
+  explicit write_queue(std::size_t max_bytes = 64 * 1024)
+    : max_bytes(max_bytes)
+  {}
+
+  void push(std::string_view data, std::string_view terminator = {});
+  // Only while nothing is being written
+  void push_front(std::string_view data, std::string_view terminator = {});
+
+  bool empty() const { return pending.empty(); }
+  bool writing() const { return in_flight > 0; }
+  std::size_t size() const { return pending.size(); }
+
+  const std::vector<asio::const_buffer>& prepare();
+  void consume();
+  // Ends a failed write; buffers fully covered by `written` bytes are dropped
+  void abort(std::size_t written);
+  void clear();
+  // Drops every pending buffer `keep` rejects; only while nothing is being written
+  void retain(const std::function<bool(std::string_view)>& keep);
+
+private:
+  std::string make_buffer(std::string_view data, std::string_view terminator);
+  void recycle(std::string buffer);
+};
+
+} // namespace dc